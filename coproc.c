@@ -0,0 +1,276 @@
+/*
+
+  coproc.c
+
+  Copyright 2014 Matthew T. Pandina. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY MATTHEW T. PANDINA "AS IS" AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHEW T. PANDINA OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+  SUCH DAMAGE.
+
+*/
+
+// IR coprocessor firmware, built with "make coproc" instead of main.c. It
+// turns the chip into an IR front-end for a bigger MCU, which reads the
+// decoded messages over the bus:
+//
+//   ATtiny85    TWI (I2C) slave on the USI, SDA on PB0 and SCL on PB2, at
+//               COPROC_TWI_ADDRESS. Only reads are answered.
+//   ATmega328P  UART at COPROC_BAUD, 8N1. Any byte the host sends is a read.
+//
+// A read returns records of 1 + sizeof(necir_message_t) bytes, oldest first:
+//
+//   byte 0: bit 7 set, bit 6 key release (NECIR_EVENTS), bits 5-4 protocol
+//           (NECIR_PROTOCOL_COUNT > 1), bits 3-0 number of repeats,
+//           saturating at 15 (0 for a new message)
+//   then:   the message, least significant byte first
+//
+// When no records are left, a status byte of zero is returned: over UART
+// that ends the read, over TWI every further byte is zero as well, so the
+// host can read several records in one transaction and ignore the empty
+// ones. A TWI read that stops inside a record drops the rest of it.
+//
+// The bus is served from its own interrupts, out of a buffer the main loop
+// fills from the message queue. These interrupts are a few dozen cycles long
+// and never wait for the host: the USI holds SCL low until its interrupt has
+// run, and the UART only sends when its data register is empty. So the
+// sampling interrupt is never held up by more than one of them, however busy
+// the bus is, and a slow host only fills the message queue.
+//
+// READY_PIN, if defined, is an active low "data ready" line. It is pulled
+// low while records are waiting and left floating otherwise, so the host
+// needs a pull-up, and several coprocessors can share the line.
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "necir.h"
+
+#if (NECIR_CHANNEL_MASK)
+#error "coproc.c forwards a single channel, build it with NECIR_CHANNEL_MASK = 0"
+#endif // NECIR_CHANNEL_MASK
+
+#if (NECIR_LOW_POWER && !defined(USICR))
+#error "The UART cannot wake the ATmega328P from power-down, build coproc.c with NECIR_LOW_POWER = 0"
+#endif // NECIR_LOW_POWER
+
+#define RECORD_SIZE (1 + sizeof(necir_message_t))
+#define RECORD_VALID 0x80
+#define RECORD_RELEASE 0x40
+#define RECORD_PROTOCOL_SHIFT 4
+#define RECORD_MAX_REPEATS 15
+
+#define LINK_LENGTH 32 // room for several records, so the host can read them in one go
+
+static volatile uint8_t linkBuffer[LINK_LENGTH];
+static volatile uint8_t linkHead; // advanced by the bus interrupts
+static volatile uint8_t linkTail; // advanced by the main loop, always by a whole record, after its bytes are written
+static uint8_t linkRecordLeft; // bytes of the record being sent that are still in linkBuffer
+
+// Returns the next byte of a read, called from the bus interrupts
+static inline uint8_t LinkNextByte(void) __attribute__(( always_inline ));
+static inline uint8_t LinkNextByte(void) {
+  uint8_t head = linkHead; // cache volatile linkHead, since this function is only ever called from inside an ISR
+  if (!linkRecordLeft) {
+    if (head == linkTail)
+      return 0; // nothing left
+    linkRecordLeft = RECORD_SIZE;
+  }
+  --linkRecordLeft;
+  uint8_t data = linkBuffer[head];
+  linkHead = (head + 1) % NELEMS(linkBuffer);
+  return data;
+}
+
+#ifdef USICR // ATtiny85: TWI slave on the USI
+
+#define USI_SDA PB0
+#define USI_SCL PB2
+
+enum {
+  USI_CHECK_ADDRESS,
+  USI_SEND_DATA,
+  USI_REQUEST_REPLY_ACK,
+  USI_CHECK_REPLY_ACK,
+};
+static uint8_t usiState;
+
+// Waits for a start condition; the start condition interrupt holds SCL low until it has run
+static inline void USI_WaitForStart(void) __attribute__(( always_inline ));
+static inline void USI_WaitForStart(void) {
+  setInput(DDRB, USI_SDA);
+  USICR = (1 << USISIE) | (1 << USIWM1) | (1 << USICS1);
+  USISR = (1 << USIOIF) | (1 << USIPF) | (1 << USIDC);
+}
+
+static inline void LinkInit(void) __attribute__(( always_inline ));
+static inline void LinkInit(void) {
+  setHigh(PORTB, USI_SDA);
+  setHigh(PORTB, USI_SCL);
+  setOutput(DDRB, USI_SCL); // driven by the USI only while it holds the clock low
+  USI_WaitForStart();
+}
+
+ISR(USI_START_vect)
+{
+  if (linkRecordLeft) { // the previous read stopped inside a record
+    linkHead = (linkHead + linkRecordLeft) % NELEMS(linkBuffer);
+    linkRecordLeft = 0;
+  }
+  usiState = USI_CHECK_ADDRESS;
+  setInput(DDRB, USI_SDA);
+  // The rest of the start condition, SCL going low, takes a few us at most
+  while (inputState(PINB, USI_SCL) && !inputState(PINB, USI_SDA))
+    ;
+  if (!inputState(PINB, USI_SDA)) // not a stop condition, so receive the address with the overflow interrupt as well
+    USICR = (1 << USISIE) | (1 << USIOIE) | (1 << USIWM1) | (1 << USIWM0) | (1 << USICS1);
+  USISR = (1 << USISIF) | (1 << USIOIF) | (1 << USIPF) | (1 << USIDC); // counts the 8 address bits, 16 clock edges
+}
+
+ISR(USI_OVF_vect)
+{
+  switch (usiState) {
+  case USI_CHECK_ADDRESS:
+    if (USIDR != (uint8_t)(((uint8_t)COPROC_TWI_ADDRESS << 1) | 1)) { // someone else, or a write (shifted unsigned, -mint8 makes int 8 bits)
+      USI_WaitForStart();
+      return;
+    }
+    usiState = USI_SEND_DATA;
+    USIDR = 0; // ACK
+    setOutput(DDRB, USI_SDA);
+    USISR = (1 << USIOIF) | (1 << USIPF) | (1 << USIDC) | 0x0E; // 1 bit, 2 clock edges
+    break;
+  case USI_CHECK_REPLY_ACK:
+    if (USIDR) { // NACK, the host has read enough
+      USI_WaitForStart();
+      return;
+    }
+    // fall through
+  case USI_SEND_DATA:
+    USIDR = LinkNextByte();
+    setOutput(DDRB, USI_SDA);
+    USISR = (1 << USIOIF) | (1 << USIPF) | (1 << USIDC); // 8 bits
+    usiState = USI_REQUEST_REPLY_ACK;
+    break;
+  case USI_REQUEST_REPLY_ACK:
+    setInput(DDRB, USI_SDA);
+    USIDR = 0;
+    USISR = (1 << USIOIF) | (1 << USIPF) | (1 << USIDC) | 0x0E; // 1 bit
+    usiState = USI_CHECK_REPLY_ACK;
+    break;
+  }
+}
+
+#else // USICR: ATmega328P: UART
+
+#define BAUD COPROC_BAUD
+#include <util/setbaud.h>
+
+static inline void LinkInit(void) __attribute__(( always_inline ));
+static inline void LinkInit(void) {
+  UBRR0H = UBRRH_VALUE;
+  UBRR0L = UBRRL_VALUE;
+#if (USE_2X)
+  UCSR0A = (1 << U2X0);
+#endif // USE_2X
+  UCSR0C = (1 << UCSZ01) | (1 << UCSZ00); // 8N1
+  UCSR0B = (1 << RXCIE0) | (1 << RXEN0) | (1 << TXEN0);
+}
+
+ISR(USART_RX_vect)
+{
+  (void)UDR0; // any byte starts a read
+  UCSR0B |= (1 << UDRIE0);
+}
+
+ISR(USART_UDRE_vect)
+{
+  bool last = !linkRecordLeft && linkHead == linkTail; // this is the zero status byte that ends the read
+  UDR0 = LinkNextByte();
+  if (last)
+    UCSR0B &= ~(1 << UDRIE0);
+}
+
+#endif // USICR
+
+int main(void)
+{
+  LinkInit();
+
+  // Initialize the NEC IR library
+  NECIR_Init();
+
+  // Enable Global Interrupts
+  sei();
+
+  for (;;) {
+    // Move whole records from the message queue to the link buffer, leaving
+    // them queued while it is full
+    while (!NECIR_QueueEmpty() &&
+           (linkHead + NELEMS(linkBuffer) - linkTail - 1) % NELEMS(linkBuffer) >= RECORD_SIZE) {
+      necir_message_t message;
+      necir_repeat_t isRepeat;
+      uint8_t status = RECORD_VALID;
+#if (NECIR_EVENTS)
+      if (NECIR_keyQueue[NECIR_head] == NECIR_KEY_RELEASE)
+        status |= RECORD_RELEASE;
+#endif // NECIR_EVENTS
+#if (NECIR_PROTOCOL_COUNT > 1)
+      uint8_t protocol;
+      NECIR_DequeueWithProtocol(&message, &isRepeat, &protocol);
+      status |= protocol << RECORD_PROTOCOL_SHIFT;
+#else // NECIR_PROTOCOL_COUNT
+      NECIR_Dequeue(&message, &isRepeat);
+#endif // NECIR_PROTOCOL_COUNT
+#if (NECIR_COALESCE_REPEATS)
+      status |= isRepeat > RECORD_MAX_REPEATS ? RECORD_MAX_REPEATS : isRepeat;
+#else // NECIR_COALESCE_REPEATS
+      status |= isRepeat;
+#endif // NECIR_COALESCE_REPEATS
+
+      uint8_t tail = linkTail;
+      linkBuffer[tail] = status;
+      for (uint8_t i = 0; i < sizeof(message); ++i) {
+        tail = (tail + 1) % NELEMS(linkBuffer);
+        linkBuffer[tail] = (uint8_t)message;
+        message >>= 8;
+      }
+      linkTail = (tail + 1) % NELEMS(linkBuffer); // volatile, so this store stays after the record and the bus interrupts only see it complete
+    }
+
+#ifdef READY_PIN
+    if (linkHead != linkTail)
+      setOutput(READY_DDR, READY_PIN); // PORT is low, so this pulls the line low
+    else
+      setInput(READY_DDR, READY_PIN);
+#endif // READY_PIN
+
+#if (NECIR_LOW_POWER)
+    // Nothing left to do until the next interrupt, the USI start condition interrupt wakes us as well
+    NECIR_Sleep();
+#endif // NECIR_LOW_POWER
+  }
+
+  return 0;
+}
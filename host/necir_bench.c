@@ -0,0 +1,454 @@
+/*
+
+  necir_bench.c
+
+  Copyright 2014 Matthew T. Pandina. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY MATTHEW T. PANDINA "AS IS" AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHEW T. PANDINA OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+  SUCH DAMAGE.
+
+*/
+
+// Cycle-accurate interrupt benchmark. Runs main.elf under simavr, drives
+// IR_PIN with scripted NEC waveforms, and reports for every scenario the
+// decode success rate and the share of CPU time spent in the decoder's
+// interrupt routines, followed by min/avg/max cycles per decoder state.
+// "make bench" builds the firmware for every DEVICE and CLOCK in the matrix
+// and runs this once per build:
+//
+//   necir_bench -m <mcu> -f <F_CPU> -i <port><pin> -x <0|1> main.elf
+//
+// -x is NECIR_USE_EXTENDED_PROTOCOL, which decides the queue entry format.
+//
+// Interrupt cycles are counted from the first instruction of the vector
+// table slot up to and including the reti, and are keyed by the decoder
+// state at entry: NECIR_decoder.state for the C routines, GPIOR1 for
+// necir_isr.S. Every __vector_N defined in the firmware is counted as a
+// decoder interrupt, since main.c defines none of its own.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <libelf.h>
+#include <gelf.h>
+
+#include "sim_avr.h"
+#include "sim_elf.h"
+#include "sim_io.h"
+#include "sim_cycle_timers.h"
+#include "avr_ioport.h"
+
+#define MAX_SEGMENTS 65536
+#define MAX_FRAMES 1024
+#define MAX_VECTORS 32
+#define NUM_STATES 13
+#define KEY_RELEASE 2 // NECIR_KEY_RELEASE, see necir.h
+
+static const char *stateNames[NUM_STATES] = {
+  "WAITING_FOR_IDLE", "IDLE", "LEADER", "PAUSE", "BIT_LEADER", "BIT_PAUSE",
+  "PROCESS", "PROCESS2", "REPEAT_PROCESS", "REPEAT_PROCESS2",
+  "SIRC_SPACE", "SIRC_MARK", "MANCHESTER"
+};
+
+// Firmware symbols, as data space or flash byte addresses
+static uint32_t stateAddress, tailAddress, queueAddress, queueSize, repeatFlagAddress, repeatCountAddress, keyAddress;
+static uint32_t vectorSlots[MAX_VECTORS];
+static int vectorCount;
+
+static const char *mcu, *firmware;
+static uint32_t frequency;
+static char irPort;
+static int irPin;
+static int extended;
+
+// The waveform of the current scenario: IR_PIN levels and how long each lasts
+static struct { uint8_t level; double us; } segments[MAX_SEGMENTS];
+static int segmentCount, nextSegment;
+static double segmentTime; // start of the next segment, in us from the start of the scenario
+static avr_cycle_count_t startCycle;
+static avr_irq_t *irPinIrq;
+
+// The messages the scenario sends, and what the firmware put on its queue
+static uint32_t frames[MAX_FRAMES];
+static int frameCount, nextFrame, framesDecoded, repeatsDecoded;
+
+static struct { uint64_t count, total, min, max; } stats[NUM_STATES];
+
+static void Segment(uint8_t level, double us)
+{
+  if (segmentCount < MAX_SEGMENTS) {
+    segments[segmentCount].level = level;
+    segments[segmentCount].us = us;
+    ++segmentCount;
+  }
+}
+
+// Sends one NEC message with address 'address' and command 'command', with every duration multiplied by 'skew'
+static void Frame(uint8_t address, uint8_t command, double skew)
+{
+  uint32_t code = address | ((uint32_t)(address ^ 0xFF) << 8) | ((uint32_t)command << 16) | ((uint32_t)(command ^ 0xFF) << 24);
+
+  Segment(0, 9000 * skew);
+  Segment(1, 4500 * skew);
+  for (int i = 0; i < 32; ++i) {
+    Segment(0, 562.5 * skew);
+    Segment(1, ((code >> i) & 1 ? 1687.5 : 562.5) * skew);
+  }
+  Segment(0, 562.5 * skew);
+
+  if (frameCount < MAX_FRAMES)
+    frames[frameCount++] = code;
+}
+
+static void RepeatCode(double skew)
+{
+  Segment(0, 9000 * skew);
+  Segment(1, 2250 * skew);
+  Segment(0, 562.5 * skew);
+}
+
+// Length of the frame sent by Frame(), so the next one can start 108ms after this one
+static double FrameLength(uint32_t code, double skew)
+{
+  double us = 9000 + 4500 + 33 * 562.5;
+  for (int i = 0; i < 32; ++i)
+    us += (code >> i) & 1 ? 1687.5 : 562.5;
+  return us * skew;
+}
+
+// Addresses 0x10-0xEF avoid the codes main.c reacts to with long delays
+#define RANDOM_ADDRESS() (0x10 + rand() % 0xE0)
+
+static void ScenarioClean(double skew)
+{
+  for (int i = 0; i < 50; ++i) {
+    Frame(RANDOM_ADDRESS(), rand(), skew);
+    Segment(1, 150000);
+  }
+}
+
+static void ScenarioRepeats(void)
+{
+  for (int i = 0; i < 10; ++i) {
+    Frame(RANDOM_ADDRESS(), rand(), 1.0);
+    Segment(1, 108000 - FrameLength(frames[frameCount - 1], 1.0));
+    for (int j = 0; j < 20; ++j) {
+      RepeatCode(1.0);
+      Segment(1, 108000 - 11812.5);
+    }
+    Segment(1, 150000);
+  }
+}
+
+// Short spikes and truncated leaders in the gaps between otherwise clean frames
+static void ScenarioGlitches(void)
+{
+  for (int i = 0; i < 50; ++i) {
+    for (int j = 0; j < 10; ++j) {
+      Segment(0, 20 + rand() % 300);
+      Segment(1, 1000 + rand() % 10000);
+    }
+    Segment(0, 1000 + rand() % 6000);
+    Segment(1, 20000);
+    Frame(RANDOM_ADDRESS(), rand(), 1.0);
+    Segment(1, 150000);
+  }
+}
+
+// Different messages at the 108ms frame period, with no idle time in between
+static void ScenarioBackToBack(void)
+{
+  for (int i = 0; i < 50; ++i) {
+    Frame(RANDOM_ADDRESS(), rand(), 1.0);
+    Segment(1, 108000 - FrameLength(frames[frameCount - 1], 1.0));
+  }
+  Segment(1, 150000);
+}
+
+static avr_cycle_count_t NextSegment(avr_t *avr, avr_cycle_count_t when, void *param)
+{
+  (void)when;
+  (void)param;
+  if (nextSegment == segmentCount)
+    return 0;
+  avr_raise_irq(irPinIrq, segments[nextSegment].level);
+  segmentTime += segments[nextSegment++].us;
+  return startCycle + avr_usec_to_cycles(avr, segmentTime);
+}
+
+static uint8_t ReadByte(avr_t *avr, uint32_t address)
+{
+  return avr->data[address];
+}
+
+// Returns how the firmware stores a message on its queue, see NECIR_EnqueueMessageIfNotFull()
+static uint32_t QueueEntry(uint32_t code)
+{
+  if (extended)
+    return ((code & 0xFF) << 24) | ((code & 0xFF00) << 8) | ((code >> 8) & 0xFF00) | (code >> 24);
+  return ((code & 0xFF) << 8) | ((code >> 16) & 0xFF);
+}
+
+// Checks the entries the interrupt routine just added to the queue
+static void CheckQueue(avr_t *avr, uint8_t *tail)
+{
+  uint32_t entrySize = extended ? 4 : 2;
+  uint32_t length = queueSize / entrySize;
+
+  while (*tail != ReadByte(avr, tailAddress)) {
+    if (keyAddress && ReadByte(avr, keyAddress + *tail) == KEY_RELEASE) {
+      // A release has the message of the key that was released, it isn't a new frame
+      *tail = (*tail + 1) % length;
+      continue;
+    }
+
+    uint32_t p = queueAddress + *tail * entrySize;
+    uint32_t value = ReadByte(avr, p) | (ReadByte(avr, p + 1) << 8);
+    if (extended)
+      value |= ((uint32_t)ReadByte(avr, p + 2) << 16) | ((uint32_t)ReadByte(avr, p + 3) << 24);
+    int isRepeat;
+    if (repeatCountAddress) // NECIR_COALESCE_REPEATS counts the repeats of an entry in a byte
+      isRepeat = ReadByte(avr, repeatCountAddress + *tail) != 0;
+    else
+      isRepeat = ReadByte(avr, repeatFlagAddress + *tail / 8) & (1 << (*tail % 8));
+
+    if (isRepeat)
+      ++repeatsDecoded;
+    else {
+      // Frames the firmware missed are skipped, so one loss doesn't fail every later frame
+      while (nextFrame < frameCount && value != QueueEntry(frames[nextFrame]))
+        ++nextFrame;
+      if (nextFrame < frameCount) {
+        ++nextFrame;
+        ++framesDecoded;
+      }
+    }
+    *tail = (*tail + 1) % length;
+  }
+}
+
+static int RunScenario(const char *name)
+{
+  elf_firmware_t f;
+  memset(&f, 0, sizeof(f));
+  if (elf_read_firmware(firmware, &f)) {
+    fprintf(stderr, "%s: could not read firmware\n", firmware);
+    return 1;
+  }
+  strncpy(f.mmcu, mcu, sizeof(f.mmcu) - 1);
+  f.frequency = frequency;
+
+  avr_t *avr = avr_make_mcu_by_name(mcu);
+  if (!avr) {
+    fprintf(stderr, "%s: unknown mcu\n", mcu);
+    return 1;
+  }
+  avr_init(avr);
+  avr_load_firmware(avr, &f);
+
+  // The receiver output idles high
+  irPinIrq = avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ(irPort), irPin);
+  avr_raise_irq(irPinIrq, 1);
+
+  nextSegment = 0;
+  segmentTime = 100000; // let the firmware initialize and settle first
+  startCycle = avr->cycle;
+  avr_cycle_timer_register(avr, startCycle + avr_usec_to_cycles(avr, segmentTime), NextSegment, NULL);
+
+  avr_cycle_count_t endCycle = startCycle + avr_usec_to_cycles(avr, segmentTime);
+  for (int i = 0; i < segmentCount; ++i)
+    endCycle += avr_usec_to_cycles(avr, segments[i].us);
+
+  uint64_t isrCycles = 0;
+  avr_cycle_count_t entryCycle = 0;
+  int inIsr = 0, state = 0;
+  uint8_t tail = ReadByte(avr, tailAddress);
+
+  while (avr->cycle < endCycle) {
+    avr_flashaddr_t pc = avr->pc;
+    if (!inIsr) {
+      for (int i = 0; i < vectorCount; ++i)
+        if (pc == vectorSlots[i]) {
+          inIsr = 1;
+          entryCycle = avr->cycle;
+          state = ReadByte(avr, stateAddress);
+          break;
+        }
+    }
+    int isReti = inIsr && (avr->flash[pc] | (avr->flash[pc + 1] << 8)) == 0x9518;
+
+    int cpuState = avr_run(avr);
+    if (cpuState == cpu_Done || cpuState == cpu_Crashed) {
+      fprintf(stderr, "%s: simulation stopped\n", name);
+      avr_terminate(avr);
+      return 1;
+    }
+
+    if (isReti) {
+      uint64_t cycles = avr->cycle - entryCycle;
+      inIsr = 0;
+      isrCycles += cycles;
+      if (state < NUM_STATES) {
+        if (!stats[state].count || cycles < stats[state].min)
+          stats[state].min = cycles;
+        if (cycles > stats[state].max)
+          stats[state].max = cycles;
+        stats[state].total += cycles;
+        ++stats[state].count;
+      }
+      CheckQueue(avr, &tail);
+    }
+  }
+
+  printf("  %-16s %3d/%-3d decoded (%5.1f%%), %4d repeats, %5.2f%% CPU in decoder\n",
+         name, framesDecoded, frameCount, 100.0 * framesDecoded / frameCount,
+         repeatsDecoded, 100.0 * isrCycles / (avr->cycle - startCycle));
+
+  avr_terminate(avr);
+  return 0;
+}
+
+static int Scenario(const char *name, int which)
+{
+  segmentCount = frameCount = nextFrame = framesDecoded = repeatsDecoded = 0;
+  srand(which + 1); // the same waveforms for every build, so results can be compared
+
+  switch (which) {
+  case 0: ScenarioClean(1.0); break;
+  case 1: ScenarioRepeats(); break;
+  case 2: ScenarioGlitches(); break;
+  case 3: ScenarioBackToBack(); break;
+  case 4: ScenarioClean(0.9); break;
+  case 5: ScenarioClean(1.1); break;
+  }
+  return RunScenario(name);
+}
+
+// Looks up the firmware symbols the benchmark needs
+static int ReadSymbols(void)
+{
+  int fd = open(firmware, O_RDONLY);
+  if (fd < 0) {
+    perror(firmware);
+    return 1;
+  }
+  elf_version(EV_CURRENT);
+  Elf *e = elf_begin(fd, ELF_C_READ, NULL);
+  Elf_Scn *scn = NULL;
+  uint32_t vectors[MAX_VECTORS];
+
+  while ((scn = elf_nextscn(e, scn))) {
+    GElf_Shdr sh;
+    gelf_getshdr(scn, &sh);
+    if (sh.sh_type != SHT_SYMTAB)
+      continue;
+    Elf_Data *data = elf_getdata(scn, NULL);
+    for (size_t i = 0; i < sh.sh_size / sh.sh_entsize; ++i) {
+      GElf_Sym sym;
+      gelf_getsym(data, i, &sym);
+      const char *symbol = elf_strptr(e, sh.sh_link, sym.st_name);
+      uint32_t address = sym.st_value & 0xFFFF; // strips the 0x800000 data space offset
+      int n;
+      if (!strcmp(symbol, "NECIR_decoder") || !strcmp(symbol, "NECIR_decoders"))
+        stateAddress = address; // state is the first member, of channel 0 for NECIR_decoders
+      else if (!strcmp(symbol, "NECIR_tail"))
+        tailAddress = address;
+      else if (!strcmp(symbol, "NECIR_messageQueue")) {
+        queueAddress = address;
+        queueSize = sym.st_size;
+      } else if (!strcmp(symbol, "NECIR_repeatFlagQueue"))
+        repeatFlagAddress = address;
+      else if (!strcmp(symbol, "NECIR_repeatCountQueue"))
+        repeatCountAddress = address;
+      else if (!strcmp(symbol, "NECIR_keyQueue"))
+        keyAddress = address;
+      else if (sscanf(symbol, "__vector_%d", &n) == 1 && vectorCount < MAX_VECTORS)
+        vectors[vectorCount++] = n;
+    }
+  }
+  elf_end(e);
+  close(fd);
+
+  if (!stateAddress) // necir_isr.S keeps the state in GPIOR1
+    stateAddress = strcmp(mcu, "attiny85") ? 0x4A : 0x34;
+  if (!tailAddress || !queueAddress || (!repeatFlagAddress && !repeatCountAddress) || !vectorCount) {
+    fprintf(stderr, "%s: NECIR symbols not found\n", firmware);
+    return 1;
+  }
+
+  // The ATmega328P uses 4-byte jmp vectors, the ATtiny85 2-byte rjmp vectors
+  int slotSize = strcmp(mcu, "attiny85") ? 4 : 2;
+  for (int i = 0; i < vectorCount; ++i)
+    vectorSlots[i] = vectors[i] * slotSize;
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  static const char *scenarios[] = { "clean", "repeats", "glitches", "back-to-back", "skew -10%", "skew +10%" };
+  int opt;
+
+  while ((opt = getopt(argc, argv, "m:f:i:x:")) != -1)
+    switch (opt) {
+    case 'm':
+      mcu = optarg;
+      break;
+    case 'f':
+      frequency = strtoul(optarg, NULL, 0);
+      break;
+    case 'i':
+      irPort = optarg[0];
+      irPin = atoi(optarg + 1);
+      break;
+    case 'x':
+      extended = atoi(optarg);
+      break;
+    default:
+      optind = argc;
+      break;
+    }
+  if (optind != argc - 1 || !mcu || !frequency || !irPort) {
+    fprintf(stderr, "usage: %s -m <mcu> -f <F_CPU> -i <port><pin> -x <0|1> main.elf\n", argv[0]);
+    return 2;
+  }
+  firmware = argv[optind];
+
+  if (ReadSymbols())
+    return 1;
+
+  printf("%s @ %" PRIu32 " Hz\n", mcu, frequency);
+  for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); ++i)
+    if (Scenario(scenarios[i], i))
+      return 1;
+
+  printf("  %-16s %9s %6s %8s %6s\n", "state", "count", "min", "avg", "max");
+  for (int i = 0; i < NUM_STATES; ++i)
+    if (stats[i].count)
+      printf("  %-16s %9" PRIu64 " %6" PRIu64 " %8.1f %6" PRIu64 "\n", stateNames[i],
+             stats[i].count, stats[i].min, (double)stats[i].total / stats[i].count, stats[i].max);
+  return 0;
+}
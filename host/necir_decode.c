@@ -0,0 +1,285 @@
+/*
+
+  necir_decode.c
+
+  Copyright 2014 Matthew T. Pandina. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY MATTHEW T. PANDINA "AS IS" AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHEW T. PANDINA OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+  SUCH DAMAGE.
+
+*/
+
+// Native batch decoder for recorded IR traces. It runs the same decoder core
+// as the firmware (necir_core.h), built with the same necir.mk settings and
+// CLOCK, and samples the trace exactly where the timer interrupt would. Build
+// it with "make necir_decode", then run:
+//
+//   necir_decode [-b | -c] [-q] [file ...]
+//
+// Files are read from stdin if none are given. Every message and every repeat
+// the firmware would have put on its queue is printed as:
+//
+//   <time in us> message|repeat <necir_message_t in hex> [protocol]
+//
+// The protocol name is only printed when more than one protocol is enabled.
+// Input formats:
+//   default  lirc mode2 text: lines of "pulse <us>", "space <us>" or
+//            "timeout <us>"; any other line is ignored
+//   -b       binary: little-endian 16-bit words, bit 15 set for a space and
+//            clear for a pulse, bits 0-14 the duration in us. Longer
+//            durations are split across several words of the same level.
+//   -c       a NECIR_CAPTURE dump: runs of samples encoded as in necir.mk,
+//            fed to the decoder sample for sample. Build with the same CLOCK
+//            as the firmware that captured it.
+//
+// -q prints only the totals and the decoding rate, on stderr. With
+// NECIR_STATS it also prints the pulses the decoder rejected, and with
+// NECIR_STATS = 2 the histograms of the measured pulse lengths in samples.
+// With NECIR_ADAPTIVE it prints the running average of the leader it ended on.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "necir_core.h"
+
+#if (NECIR_USE_EXTENDED_PROTOCOL)
+typedef uint32_t necir_message_t;
+#define MESSAGE_FORMAT "0x%08" PRIX32
+#else // NECIR_USE_EXTENDED_PROTOCOL
+typedef uint16_t necir_message_t;
+#define MESSAGE_FORMAT "0x%04" PRIX16
+#endif // NECIR_USE_EXTENDED_PROTOCOL
+
+// One sample period, in units of 1/F_CPU us, so a pulse of N us lasts N * F_CPU units
+#define SAMPLE_PERIOD ((uint64_t)(NECIR_CTC_TOP + 1) * NECIR_CTC_PRESCALE * 1000000)
+
+static necir_decoder_t decoder;
+static uint64_t phase; // time since the last sample, in units of 1/F_CPU us
+static uint64_t samples; // samples taken so far
+static uint64_t pulses, messages, repeats, invalid;
+static int quiet;
+
+#if (NECIR_PROTOCOL_COUNT > 1)
+static const char *const protocolNames[] = { "nec", "samsung32", "sirc", "rc5" };
+#endif // NECIR_PROTOCOL_COUNT
+
+static void Event(uint8_t event)
+{
+  uint32_t value;
+
+  if (event != NECIR_EVENT_MESSAGE && event != NECIR_EVENT_REPEAT)
+    return;
+  if (!NECIR_DecoderValue(&decoder, &value)) { // same conversion as NECIR_EnqueueMessageIfNotFull()
+    ++invalid;
+    NECIR_DecoderDrop(&decoder);
+    return;
+  }
+  if (event == NECIR_EVENT_MESSAGE)
+    ++messages;
+  else
+    ++repeats;
+  if (!quiet) {
+    printf("%" PRIu64 " %s " MESSAGE_FORMAT, samples * SAMPLE_PERIOD / F_CPU,
+           event == NECIR_EVENT_MESSAGE ? "message" : "repeat", (necir_message_t)value);
+#if (NECIR_PROTOCOL_COUNT > 1)
+    printf(" %s", protocolNames[NECIR_DecoderProtocol(&decoder)]);
+#endif // NECIR_PROTOCOL_COUNT
+    putchar('\n');
+  }
+}
+
+#if (NECIR_STATS)
+#if (NECIR_STATS == 2)
+static void PrintHistogram(const char *name, const uint16_t *histogram, size_t length)
+{
+  fprintf(stderr, "%-9s", name);
+  for (size_t i = 0; i < length; ++i)
+    if (histogram[i])
+      fprintf(stderr, " %zu:%u", i, histogram[i]);
+  fputc('\n', stderr);
+}
+#endif // NECIR_STATS
+
+// Only the counters kept by the decoder core, the queue is not simulated
+static void PrintStats(const necir_stats_t *stats)
+{
+  fprintf(stderr, "rejected %u leaders, %u pauses, %u bursts, %u spaces, %u addresses\n",
+          stats->leaderErrors, stats->pauseErrors, stats->bitBurstErrors, stats->bitSpaceErrors, stats->addressRejected);
+#if (NECIR_STATS == 2)
+  PrintHistogram("leader", stats->leaderHistogram, sizeof(stats->leaderHistogram) / sizeof(stats->leaderHistogram[0]));
+#if (NECIR_PROTOCOL_NEC || NECIR_PROTOCOL_SAMSUNG32)
+  PrintHistogram("pause", stats->pauseHistogram, sizeof(stats->pauseHistogram) / sizeof(stats->pauseHistogram[0]));
+#endif // NECIR_PROTOCOL_NEC || NECIR_PROTOCOL_SAMSUNG32
+  PrintHistogram("burst", stats->bitBurstHistogram, sizeof(stats->bitBurstHistogram) / sizeof(stats->bitBurstHistogram[0]));
+  PrintHistogram("space", stats->bitSpaceHistogram, sizeof(stats->bitSpaceHistogram) / sizeof(stats->bitSpaceHistogram[0]));
+#endif // NECIR_STATS
+}
+#endif // NECIR_STATS
+
+// Feeds 'count' samples of a pulse (sample = 0) or space (sample = 1)
+static void FeedSamples(uint8_t sample, uint64_t count)
+{
+  ++pulses;
+  while (count) {
+    uint32_t chunk = count > UINT32_MAX ? UINT32_MAX : (uint32_t)count;
+    uint32_t skipped = NECIR_DecoderSkip(&decoder, sample, chunk);
+    count -= skipped;
+    samples += skipped;
+    if (count) {
+      --count;
+      ++samples;
+      Event(NECIR_DecoderStep(&decoder, sample));
+    }
+  }
+}
+
+// Feeds the samples that fall within a pulse (sample = 0) or space (sample = 1) of 'us' microseconds
+static void Feed(uint8_t sample, uint64_t us)
+{
+  phase += us * F_CPU;
+  FeedSamples(sample, phase / SAMPLE_PERIOD);
+  phase %= SAMPLE_PERIOD;
+}
+
+static void DecodeCapture(FILE *f)
+{
+  int c;
+
+  while ((c = getc(f)) != EOF) {
+    uint8_t sample = (c & 0x80) ? 1 : 0; // the same bit as NECIR_CAPTURE_SPACE
+    uint64_t count = c & 0x3F;
+    if (c & 0x40) { // NECIR_CAPTURE_MORE
+      if ((c = getc(f)) == EOF)
+        break;
+      count |= (uint64_t)(c & 0x7F) << 6;
+      if (c & 0x80) {
+        if ((c = getc(f)) == EOF)
+          break;
+        count |= (uint64_t)c << 13;
+      }
+    }
+    FeedSamples(sample, count);
+  }
+}
+
+static void DecodeBinary(FILE *f)
+{
+  static uint8_t buffer[65536];
+  size_t n;
+
+  while ((n = fread(buffer, 2, sizeof(buffer) / 2, f)) > 0)
+    for (size_t i = 0; i < n; ++i) {
+      uint16_t word = buffer[2 * i] | ((uint16_t)buffer[2 * i + 1] << 8);
+      Feed(word >> 15, word & 0x7FFF);
+    }
+}
+
+static void DecodeText(FILE *f)
+{
+  char line[256];
+
+  while (fgets(line, sizeof(line), f)) {
+    const char *p = line;
+    uint8_t sample;
+
+    while (*p == ' ' || *p == '\t')
+      ++p;
+    if (!strncmp(p, "pulse", 5))
+      sample = 0;
+    else if (!strncmp(p, "space", 5) || !strncmp(p, "timeout", 7))
+      sample = 1;
+    else
+      continue;
+    while (*p && *p != ' ' && *p != '\t')
+      ++p;
+
+    uint64_t us = 0;
+    while (*p == ' ' || *p == '\t')
+      ++p;
+    while (*p >= '0' && *p <= '9')
+      us = us * 10 + (*p++ - '0');
+    Feed(sample, us);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int binary = 0, capture = 0;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "bcq")) != -1)
+    switch (opt) {
+    case 'b':
+      binary = 1;
+      break;
+    case 'c':
+      capture = 1;
+      break;
+    case 'q':
+      quiet = 1;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-b | -c] [-q] [file ...]\n", argv[0]);
+      return 2;
+    }
+
+  NECIR_DecoderInit(&decoder);
+
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  void (*decode)(FILE *f) = capture ? DecodeCapture : (binary ? DecodeBinary : DecodeText);
+  if (optind == argc)
+    decode(stdin);
+  for (int i = optind; i < argc; ++i) {
+    FILE *f = fopen(argv[i], binary || capture ? "rb" : "r");
+    if (!f) {
+      perror(argv[i]);
+      return 1;
+    }
+    decode(f);
+    fclose(f);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  if (quiet) {
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    fprintf(stderr, "%" PRIu64 " pulses, %.1f s of signal, %" PRIu64 " messages, %" PRIu64 " repeats, %" PRIu64 " invalid\n",
+            pulses, (double)samples * SAMPLE_PERIOD / F_CPU / 1e6, messages, repeats, invalid);
+    fprintf(stderr, "decoded in %.3f s, %.0f messages/s, %.0f pulses/s\n",
+            seconds, (messages + repeats) / seconds, pulses / seconds);
+#if (NECIR_ADAPTIVE)
+    fprintf(stderr, "leader average %.2f samples\n", decoder.leaderAverage / 16.0);
+#endif // NECIR_ADAPTIVE
+#if (NECIR_STATS)
+    PrintStats(&decoder.stats);
+#endif // NECIR_STATS
+  }
+  return 0;
+}
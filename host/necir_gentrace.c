@@ -0,0 +1,221 @@
+/*
+
+  necir_gentrace.c
+
+  Copyright 2014 Matthew T. Pandina. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY MATTHEW T. PANDINA "AS IS" AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHEW T. PANDINA OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+  SUCH DAMAGE.
+
+*/
+
+// Synthetic NEC trace generator for regression tests of the decoder timing.
+// Writes random NEC frames, each followed by repeat codes at the native 108ms
+// period, to a binary trace as read by "necir_decode -b", and prints on
+// stdout what necir_decode should print for it, without the time column:
+//
+//   necir_gentrace [-s scale] [-j jitter] [-n frames] [-r repeats] [-e seed] trace.bin
+//
+// -s multiplies every duration, gaps included, to mimic a remote whose clock
+//    is off (default 1.0)
+// -j is the random error of each pulse and space, in percent (default 1)
+// -n is the number of frames (default 300)
+// -r is the number of repeat codes after each frame (default 10)
+// -e seeds the random numbers, the same seed always gives the same trace
+//
+// Build it with the same necir.mk settings as necir_decode ("make
+// necir_gentrace"), since the expected output depends on the message format,
+// the repeat settings and NECIR_ADDRESS_FILTER. "make check" runs both.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <unistd.h>
+
+#if (!NECIR_PROTOCOL_NEC)
+#error "necir_gentrace only generates NEC frames, NECIR_PROTOCOL_NEC must be 1"
+#endif // NECIR_PROTOCOL_NEC
+
+#if (NECIR_PROTOCOL_NEC + NECIR_PROTOCOL_SAMSUNG32 + NECIR_PROTOCOL_SIRC + NECIR_PROTOCOL_RC5 > 1)
+#define PROTOCOL_SUFFIX " nec" // necir_decode names the protocol when there is more than one
+#else // NECIR_PROTOCOL_COUNT
+#define PROTOCOL_SUFFIX ""
+#endif // NECIR_PROTOCOL_COUNT
+
+#ifdef NECIR_ADDRESS_FILTER
+static const uint16_t addressFilter[] = { NECIR_ADDRESS_FILTER };
+#endif // NECIR_ADDRESS_FILTER
+
+static FILE *trace;
+static double scale = 1.0, jitter = 1.0;
+static uint32_t seed = 1;
+
+// xorshift32, so a seed gives the same trace with every C library
+static uint32_t Random(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return seed;
+}
+
+// Writes a pulse (space = 0) or space (space = 1) of nominally 'us' microseconds
+static void Write(uint8_t space, double us)
+{
+  double error = 1.0 + jitter / 100.0 * ((double)Random() / UINT32_MAX * 2.0 - 1.0);
+  uint32_t length = (uint32_t)(us * scale * error + 0.5);
+
+  if (!length)
+    length = 1;
+  while (length) {
+    uint16_t word = length > 0x7FFF ? 0x7FFF : length;
+    putc(word & 0xFF, trace);
+    putc((word >> 8) | (space << 7), trace);
+    length -= word;
+  }
+}
+
+// Writes a frame, and returns its length in us
+static double Frame(uint32_t code)
+{
+  double us = 9000 + 4500 + 33 * 562.5;
+
+  Write(0, 9000);
+  Write(1, 4500);
+  for (uint8_t i = 0; i < 32; ++i) {
+    Write(0, 562.5);
+    Write(1, (code >> i) & 1 ? 1687.5 : 562.5);
+    us += (code >> i) & 1 ? 1687.5 : 562.5;
+  }
+  Write(0, 562.5);
+  return us;
+}
+
+// Returns whether NECIR_ADDRESS_FILTER lets the frame through, see NECIR_DecoderAddressAllowed()
+static int AddressAllowed(uint32_t code)
+{
+#ifdef NECIR_ADDRESS_FILTER
+#if (NECIR_USE_EXTENDED_PROTOCOL)
+  uint16_t address = ((code & 0xFF) << 8) | ((code >> 8) & 0xFF);
+#else // NECIR_USE_EXTENDED_PROTOCOL
+  uint16_t address = code & 0xFF;
+#endif // NECIR_USE_EXTENDED_PROTOCOL
+  for (size_t i = 0; i < sizeof(addressFilter) / sizeof(addressFilter[0]); ++i)
+    if (addressFilter[i] == address)
+      return 1;
+  return 0;
+#else // NECIR_ADDRESS_FILTER
+  (void)code;
+  return 1;
+#endif // NECIR_ADDRESS_FILTER
+}
+
+// Prints the message as necir_decode does, see NECIR_DecoderValue()
+static void Print(const char *event, uint32_t code)
+{
+#if (NECIR_USE_EXTENDED_PROTOCOL)
+  uint32_t value = ((code & 0xFF) << 24) | ((code & 0xFF00) << 8) | ((code >> 8) & 0xFF00) | (code >> 24);
+  printf("%s 0x%08" PRIX32 PROTOCOL_SUFFIX "\n", event, value);
+#else // NECIR_USE_EXTENDED_PROTOCOL
+  uint32_t value = ((code & 0xFF) << 8) | ((code >> 16) & 0xFF);
+  printf("%s 0x%04" PRIX32 PROTOCOL_SUFFIX "\n", event, value);
+#endif // NECIR_USE_EXTENDED_PROTOCOL
+}
+
+int main(int argc, char *argv[])
+{
+  unsigned long frames = 300, repeats = 10;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "s:j:n:r:e:")) != -1)
+    switch (opt) {
+    case 's':
+      scale = atof(optarg);
+      break;
+    case 'j':
+      jitter = atof(optarg);
+      break;
+    case 'n':
+      frames = strtoul(optarg, NULL, 0);
+      break;
+    case 'r':
+      repeats = strtoul(optarg, NULL, 0);
+      break;
+    case 'e':
+      seed = strtoul(optarg, NULL, 0);
+      if (!seed)
+        seed = 1; // xorshift never leaves zero
+      break;
+    default:
+      optind = argc;
+      break;
+    }
+  if (optind != argc - 1 || scale <= 0 || jitter < 0 || jitter >= 100) {
+    fprintf(stderr, "usage: %s [-s scale] [-j jitter] [-n frames] [-r repeats] [-e seed] trace.bin\n", argv[0]);
+    return 2;
+  }
+  if (!(trace = fopen(argv[optind], "wb"))) {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  Write(1, 100000); // the decoder starts out waiting for idle
+  for (unsigned long i = 0; i < frames; ++i) {
+    uint8_t address = Random();
+    uint8_t command = Random();
+    uint32_t code = address | ((uint32_t)(address ^ 0xFF) << 8) | ((uint32_t)command << 16) | ((uint32_t)(command ^ 0xFF) << 24);
+    int allowed = AddressAllowed(code);
+
+    if (allowed)
+      Print("message", code);
+    Write(1, 108000 - Frame(code));
+
+    // The same counting as NECIR_DecoderBeginRepeats() and NECIR_DecoderRepeatCodeReceived()
+    uint8_t nativeRepeatsNeeded = NECIR_DELAY_UNTIL_REPEAT;
+#if (NECIR_TURBO_MODE_AFTER != 0)
+    uint8_t turboModeCounter = 0;
+#endif // NECIR_TURBO_MODE_AFTER
+    for (unsigned long j = 0; j < repeats; ++j) {
+      Write(0, 9000);
+      Write(1, 2250);
+      Write(0, 562.5);
+      Write(1, 108000 - 11812.5);
+      if (allowed && --nativeRepeatsNeeded == 0) {
+        nativeRepeatsNeeded = NECIR_REPEAT_INTERVAL;
+#if (NECIR_TURBO_MODE_AFTER != 0)
+        if (++turboModeCounter == NECIR_TURBO_MODE_AFTER) {
+          --turboModeCounter;
+          nativeRepeatsNeeded = NECIR_TURBO_REPEAT_INTERVAL;
+        }
+#endif // NECIR_TURBO_MODE_AFTER
+        Print("repeat", code);
+      }
+    }
+    Write(1, 150000); // key released, lets the repeat timeout expire
+  }
+
+  fclose(trace);
+  return 0;
+}
@@ -5,6 +5,94 @@
 
 #include "necir.h"
 
+#if (NECIR_SCHEDULER)
+// The LED is toggled back by a task instead of after _delay_ms(), so the
+// main loop keeps draining the queue while it blinks
+static uint16_t blinkLength; // milliseconds the LED stays toggled
+static uint16_t blinkLeft; // milliseconds until the blink in progress is over
+
+static void BlinkTask(void)
+{
+  if (blinkLeft && --blinkLeft == blinkLength)
+    setHigh(LED_INPUT, LED_PIN);
+}
+
+static const necir_task_t tasks[] PROGMEM = {
+  { 1, BlinkTask },
+};
+
+// Toggles the LED for 'ms', then leaves it alone for as long again, like the
+// _delay_ms() version. A blink asked for while one is in progress is dropped.
+static void Blink(uint16_t ms)
+{
+  if (blinkLeft)
+    return;
+  setHigh(LED_INPUT, LED_PIN);
+  blinkLength = ms;
+  blinkLeft = 2 * ms;
+}
+#define BLINK(ms) Blink((uint16_t)(ms))
+#else // NECIR_SCHEDULER
+#define BLINK(ms)                     \
+  do {                                \
+    for (uint8_t i = 0; i < 2; ++i) { \
+      setHigh(LED_INPUT, LED_PIN);    \
+      _delay_ms(ms);                  \
+    }                                 \
+  } while (0)
+#endif // NECIR_SCHEDULER
+
+#if (NECIR_DISPATCH)
+// The same LED patterns as the if-chain in main(), as handlers for NECIR_Dispatch()
+static void PowerPressed(necir_message_t message, necir_repeat_t isRepeat)
+{
+  (void)message;
+  (void)isRepeat;
+  setHigh(LED_INPUT, LED_PIN);
+}
+
+#define BLINK_HANDLER(name, ms)                                      \
+  static void name(necir_message_t message, necir_repeat_t isRepeat) \
+  {                                                                  \
+    (void)message;                                                   \
+    (void)isRepeat;                                                  \
+    BLINK(ms);                                                       \
+  }
+BLINK_HANDLER(VolumeUp, 37.5)
+BLINK_HANDLER(VolumeDown, 50)
+BLINK_HANDLER(ChannelUp, 12.5)
+BLINK_HANDLER(ChannelDown, 25)
+
+// Sorted by message, since NECIR_Dispatch() does a binary search
+static const necir_dispatch_t keys[] PROGMEM = {
+#if (NECIR_USE_EXTENDED_PROTOCOL)
+  { 0x04FB00FF, NECIR_DISPATCH_REPEATS, ChannelUp },
+  { 0x04FB01FE, NECIR_DISPATCH_REPEATS, ChannelDown },
+  { 0x04FB02FD, NECIR_DISPATCH_REPEATS, VolumeUp },
+  { 0x04FB03FC, NECIR_DISPATCH_REPEATS, VolumeDown },
+  { 0x04FB08F7, 0, PowerPressed }, // disallow repeat for power button
+#else // NECIR_USE_EXTENDED_PROTOCOL
+  { 0x0400, NECIR_DISPATCH_REPEATS, ChannelUp },
+  { 0x0401, NECIR_DISPATCH_REPEATS, ChannelDown },
+  { 0x0402, NECIR_DISPATCH_REPEATS, VolumeUp },
+  { 0x0403, NECIR_DISPATCH_REPEATS, VolumeDown },
+  { 0x0408, 0, PowerPressed }, // disallow repeat for power button
+#endif // NECIR_USE_EXTENDED_PROTOCOL
+};
+
+#if (NECIR_USE_EXTENDED_PROTOCOL)
+// Every other key of the Adafruit Mini IR Remote
+static void OtherKey(necir_message_t message, necir_repeat_t isRepeat)
+{
+  (void)isRepeat;
+  if ((uint16_t)(message >> 16) == 0x00BF) // Address bits for Adafruit Mini IR Remote
+    BLINK(250);
+}
+#else // NECIR_USE_EXTENDED_PROTOCOL
+#define OtherKey NULL
+#endif // NECIR_USE_EXTENDED_PROTOCOL
+#endif // NECIR_DISPATCH
+
 int main(void)
 {
   // Set diagnostic LED pin as output and turn LED off
@@ -13,12 +101,22 @@ int main(void)
   
   // Initialize the NEC IR library
   NECIR_Init();
+
+#if (NECIR_DISPATCH)
+  // A key table out of order makes keys go missing, so stop with the LED on
+  if (!NECIR_DispatchTableSorted(keys, NELEMS(keys))) {
+    setHigh(LED_PORT, LED_PIN);
+    for (;;);
+  }
+#endif // NECIR_DISPATCH
   
   // Enable Global Interrupts
   sei();
 
+#if (!NECIR_DISPATCH)
   necir_message_t message; // stores the decoded message
-  bool isRepeat; // whether the message is a repeat message or not
+  necir_repeat_t isRepeat; // whether the message is a repeat message or not (with NECIR_COALESCE_REPEATS, how many repeats)
+#endif // NECIR_DISPATCH
 
   // The following block of code is used for profiling the execution
   // time of the interrupt using a logic analyzer. The inline asm is
@@ -35,9 +133,26 @@ int main(void)
  /*  goto loop; */
 
   for (;;) {
+#if (NECIR_SCHEDULER)
+    // Run the tasks that are due, which finish the LED blinks
+    NECIR_RunTasks(tasks, NELEMS(tasks));
+#endif // NECIR_SCHEDULER
+
+#if (NECIR_DISPATCH)
+    // Process all queued NEC IR events, with a table lookup rather than the if-chain below
+    NECIR_Dispatch(keys, NELEMS(keys), OtherKey);
+#else // NECIR_DISPATCH
     // Process all queued NEC IR events
     while (!NECIR_QueueEmpty()) {
+#if (NECIR_EVENTS)
+      uint8_t key;
+      necir_tick_t ticks;
+      NECIR_DequeueWithEvent(&message, &isRepeat, &key, &ticks);
+      if (key == NECIR_KEY_RELEASE) // this demo only reacts to presses and repeats
+        continue;
+#else // NECIR_EVENTS
       NECIR_Dequeue(&message, &isRepeat);
+#endif // NECIR_EVENTS
 
       // In a typical application, you will choose to either support
       // the normal NECIR protocol, or the extended NECIR protocol, so
@@ -51,56 +166,33 @@ int main(void)
       if (message == 0x04FB08F7 && !isRepeat) // disallow repeat for power button
         setHigh(LED_INPUT, LED_PIN);
       else if (message == 0x04FB02FD) // VOL_UP
-        for (uint8_t i = 0; i < 2; ++i) {
-          setHigh(LED_INPUT, LED_PIN);
-          _delay_ms(37.5);
-        }
+        BLINK(37.5);
       else if (message == 0x04FB03FC) // VOL_DN
-        for (uint8_t i = 0; i < 2; ++i) {
-          setHigh(LED_INPUT, LED_PIN);
-          _delay_ms(50);
-        }
+        BLINK(50);
       else if (message == 0x04FB00FF) // CH_UP
-        for (uint8_t i = 0; i < 2; ++i) {
-          setHigh(LED_INPUT, LED_PIN);
-          _delay_ms(12.5);
-        }
+        BLINK(12.5);
       else if (message == 0x04FB01FE) // CH_DN
-        for (uint8_t i = 0; i < 2; ++i) {
-          setHigh(LED_INPUT, LED_PIN);
-          _delay_ms(25);
-        }
+        BLINK(25);
       else if ((uint16_t)(message >> 16) == 0x00BF) // Address bits for Adafruit Mini IR Remote
-        for (uint8_t i = 0; i < 2; ++i) {
-          setHigh(LED_INPUT, LED_PIN);
-          _delay_ms(250);
-        }
+        BLINK(250);
 
 #else // NECIR_SUPPORT_EXTENDED_PROTOCOL
       if (message == 0x0408 && !isRepeat) // disallow repeat for power button
         setHigh(LED_INPUT, LED_PIN);
       else if (message == 0x0402) // VOL_UP
-        for (uint8_t i = 0; i < 2; ++i) {
-          setHigh(LED_INPUT, LED_PIN);
-          _delay_ms(37.5);
-        }
+        BLINK(37.5);
       else if (message == 0x0403) // VOL_DN
-        for (uint8_t i = 0; i < 2; ++i) {
-          setHigh(LED_INPUT, LED_PIN);
-          _delay_ms(50);
-        }
+        BLINK(50);
       else if (message == 0x0400) // CH_UP
-        for (uint8_t i = 0; i < 2; ++i) {
-          setHigh(LED_INPUT, LED_PIN);
-          _delay_ms(12.5);
-        }
+        BLINK(12.5);
       else if (message == 0x0401) // CH_DN
-        for (uint8_t i = 0; i < 2; ++i) {
-          setHigh(LED_INPUT, LED_PIN);
-          _delay_ms(25);
-        }
+        BLINK(25);
 #endif // NECIR_SUPPORT_EXTENDED_PROTOCOL
     }
+#endif // NECIR_DISPATCH
+
+    // Nothing left to do until the next message, or the next task, so sleep instead of polling the queue
+    NECIR_WaitMessage();
   }
 
   return 0;
@@ -31,19 +31,86 @@
 */
 
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
 
+// The decoder hooks must be defined before necir.h includes necir_core.h
+#if (NECIR_USE_GPIOR0)
+#define NECIR_FLAGS GPIOR0
+#if (!NECIR_CHANNEL_MASK) // with several channels, every decoder keeps its own flag
+#define NECIR_CORE_GET_REPEAT_TIMEOUT_FLAG(d) getValue(NECIR_FLAGS, NECIR_FLAG_REPEAT_TIMEOUT)
+#define NECIR_CORE_SET_REPEAT_TIMEOUT_FLAG(d) setHigh(NECIR_FLAGS, NECIR_FLAG_REPEAT_TIMEOUT)
+#define NECIR_CORE_CLEAR_REPEAT_TIMEOUT_FLAG(d) setLow(NECIR_FLAGS, NECIR_FLAG_REPEAT_TIMEOUT)
+#endif // NECIR_CHANNEL_MASK
+#endif // NECIR_USE_GPIOR0
+#define NECIR_CORE_BIT_MASK(n) pgm_read_byte(&NECIR_oneLeftShiftedBy[n])
+#define NECIR_CORE_FILTER_STORAGE PROGMEM
+#if (NECIR_USE_EXTENDED_PROTOCOL)
+#define NECIR_CORE_READ_FILTER(p) pgm_read_word(p)
+#else // NECIR_USE_EXTENDED_PROTOCOL
+#define NECIR_CORE_READ_FILTER(p) pgm_read_byte(p)
+#endif // NECIR_USE_EXTENDED_PROTOCOL
 #include "necir.h"
 
-// Auto-calculate timer interval to ensure that we sample the shortest pulse
-// (562.5us) at least twice. Changing NECIR_CTC_PRESCALE below will not
-// actually change the prescale value; the define only exists to avoid using
-// a "magic number" in the definition of NECIR_CTC_TOP and in the definition
-// of NUM_SAMPLES_IN_MS().
-#define NECIR_CTC_PRESCALE 64
-#define NECIR_CTC_TOP ((uint8_t)(F_CPU * (0.0005625 / 2) / NECIR_CTC_PRESCALE) - 1)
+#if (NECIR_CHANNEL_MASK)
+#if (NECIR_DECODE_MODE != 0 || NECIR_ASM_ISR)
+#error "NECIR_CHANNEL_MASK requires NECIR_DECODE_MODE = 0 and NECIR_ASM_ISR = 0"
+#endif // NECIR_DECODE_MODE || NECIR_ASM_ISR
+#define NECIR_CHANNELS __builtin_popcount(NECIR_CHANNEL_MASK)
+#define NECIR_INPUT_MASK NECIR_CHANNEL_MASK
+#else // NECIR_CHANNEL_MASK
+#define NECIR_INPUT_MASK (1 << IR_PIN)
+#endif // NECIR_CHANNEL_MASK
+
+#if ((NECIR_PROTOCOL_COUNT > 1 || !NECIR_PROTOCOL_NEC) && (NECIR_DECODE_MODE != 0 || NECIR_ASM_ISR))
+#error "Protocols other than NEC require NECIR_DECODE_MODE = 0 and NECIR_ASM_ISR = 0"
+#endif // NECIR_PROTOCOL_COUNT || NECIR_PROTOCOL_NEC
+
+#if (NECIR_EVENTS && (NECIR_DECODE_MODE != 0 || NECIR_ASM_ISR))
+#error "NECIR_EVENTS requires NECIR_DECODE_MODE = 0 and NECIR_ASM_ISR = 0"
+#endif // NECIR_EVENTS
 
-// Only call this macro with a constant, otherwise it won't compile down to a constant!
-#define NUM_SAMPLES_IN_MS(ms) ((ms) / ((float)(NECIR_CTC_TOP + 1) * NECIR_CTC_PRESCALE * 1000 / F_CPU))
+#if (NECIR_TX && (NECIR_DECODE_MODE != 0 || NECIR_LOW_POWER || NECIR_ASM_ISR))
+#error "NECIR_TX requires NECIR_DECODE_MODE = 0, NECIR_LOW_POWER = 0 and NECIR_ASM_ISR = 0"
+#endif // NECIR_TX
+
+#if (NECIR_CAPTURE && (NECIR_DECODE_MODE != 0 || NECIR_LOW_POWER || NECIR_ASM_ISR))
+#error "NECIR_CAPTURE requires NECIR_DECODE_MODE = 0, NECIR_LOW_POWER = 0 and NECIR_ASM_ISR = 0"
+#endif // NECIR_CAPTURE
+
+#if (NECIR_SCHEDULER && (NECIR_DECODE_MODE != 0 || NECIR_LOW_POWER || NECIR_ASM_ISR))
+#error "NECIR_SCHEDULER requires NECIR_DECODE_MODE = 0, NECIR_LOW_POWER = 0 and NECIR_ASM_ISR = 0"
+#endif // NECIR_SCHEDULER
+
+#if (NECIR_ADAPTIVE && (NECIR_DECODE_MODE != 0 || NECIR_ASM_ISR))
+#error "NECIR_ADAPTIVE requires NECIR_DECODE_MODE = 0 and NECIR_ASM_ISR = 0"
+#endif // NECIR_ADAPTIVE
+
+#if (NECIR_DECODE_MODE == 0)
+#define NECIR_REPEAT_TIMEOUT NECIR_SAMPLED_REPEAT_TIMEOUT
+#elif (NECIR_DECODE_MODE == 1)
+// In edge mode the timer runs freely with the same prescaler, so one timer
+// count is NECIR_CTC_PRESCALE clock cycles, and one sample of the periodic
+// decoder is NECIR_TICKS_PER_SAMPLE timer counts. Scaling the sampled
+// decoder's thresholds by that amount makes both modes accept exactly the
+// same pulse widths. A pulse of N samples is accepted by the sampled decoder
+// when it lasts between N - 1 and N + 2 samples, which is what the
+// NECIR_EDGE_MIN() and NECIR_EDGE_MAX() macros below encode.
+#define NECIR_TICKS_PER_SAMPLE ((uint16_t)NECIR_CTC_TOP + 1)
+#define NECIR_EDGE_MIN(t) ((uint16_t)(NECIR_SAMPLES(t) - NECIR_SAMPLES_PER_BIT + 1) * NECIR_TICKS_PER_SAMPLE)
+#define NECIR_EDGE_MAX(t) ((uint16_t)(NECIR_SAMPLES(t) + NECIR_SAMPLES_PER_BIT / 2 + 1) * NECIR_TICKS_PER_SAMPLE)
+_Static_assert((NECIR_TIME_TO_SAMPLES(NECIR_NEC_LEADER) + NECIR_SAMPLES_PER_BIT / 2 + 1) * (NECIR_CTC_TOP + 1) <= UINT16_MAX, "pulse lengths do not fit the 16-bit edge timestamps");
+
+// Measured in timer overflows (256 timer counts each), same length as above
+#define NECIR_REPEAT_TIMEOUT ((uint16_t)((uint32_t)110 * (F_CPU / 1000) / ((uint32_t)NECIR_CTC_PRESCALE * 256)) + 1)
+#else // NECIR_DECODE_MODE
+#error "NECIR_DECODE_MODE must be 0 or 1"
+#endif // NECIR_DECODE_MODE
+
+#if (NECIR_LOW_POWER)
+// Oscillator start-up time after power-down, in samples and in timer counts
+#define NECIR_WAKEUP_SAMPLES ((uint8_t)(((uint32_t)NECIR_WAKEUP_CYCLES + NECIR_SAMPLE_CYCLES / 2) / NECIR_SAMPLE_CYCLES))
+#define NECIR_WAKEUP_TICKS ((uint16_t)(NECIR_WAKEUP_CYCLES / NECIR_CTC_PRESCALE))
+#endif // NECIR_LOW_POWER
 
 // Avoids having to bit shift by a variable amount; always runs in constant time
 const uint8_t NECIR_oneLeftShiftedBy[8] PROGMEM = {1, 2, 4, 8, 16, 32, 64, 128};
@@ -52,45 +119,162 @@ const uint8_t NECIR_oneLeftShiftedBy[8] PROGMEM = {1, 2, 4, 8, 16, 32, 64, 128};
 #error "NECIR_QUEUE_LENGTH must be between 1 and 256, powers of two strongly preferred"
 #endif // NECIR_QUEUE_LENGTH
 volatile necir_message_t NECIR_messageQueue[NECIR_QUEUE_LENGTH];
+#if (NECIR_COALESCE_REPEATS)
+volatile uint8_t NECIR_repeatCountQueue[NECIR_QUEUE_LENGTH];
+#else // NECIR_COALESCE_REPEATS
 volatile uint8_t NECIR_repeatFlagQueue[NECIR_REPEAT_QUEUE_BYTES];
+#endif // NECIR_COALESCE_REPEATS
 uint8_t NECIR_head; // initialized to zero by default
 volatile uint8_t NECIR_tail; // initialized to zero by default
+#if (NECIR_CHANNEL_MASK)
+volatile uint8_t NECIR_channelQueue[NECIR_QUEUE_LENGTH];
+#endif // NECIR_CHANNEL_MASK
+#if (NECIR_PROTOCOL_COUNT > 1)
+volatile uint8_t NECIR_protocolQueue[NECIR_QUEUE_LENGTH];
+#endif // NECIR_PROTOCOL_COUNT
+#if (NECIR_EVENTS)
+volatile uint8_t NECIR_keyQueue[NECIR_QUEUE_LENGTH];
+volatile necir_tick_t NECIR_timestampQueue[NECIR_QUEUE_LENGTH];
+#endif // NECIR_EVENTS
+#if (NECIR_EVENTS || NECIR_SCHEDULER)
+static volatile necir_tick_t NECIR_ticks; // advanced by every sampling interrupt
+#endif // NECIR_EVENTS || NECIR_SCHEDULER
+#if (NECIR_SCHEDULER)
+static volatile uint32_t NECIR_millis; // advanced by the sampling interrupt that completes each millisecond
+static uint16_t NECIR_millisFraction; // clock cycles of the current millisecond so far, only used by the sampling interrupt
+static volatile uint16_t NECIR_taskDue; // low 16 bits of NECIR_millis when the earliest task is due
+static volatile bool NECIR_taskPending; // set when NECIR_taskDue is reached
+static uint16_t NECIR_taskDues[NECIR_SCHEDULER]; // low 16 bits of NECIR_millis when each task is due
+#endif // NECIR_SCHEDULER
+#if (NECIR_TX)
+volatile necir_message_t NECIR_sendQueue[NECIR_TX_QUEUE_LENGTH];
+volatile uint8_t NECIR_sendRepeatsQueue[NECIR_TX_QUEUE_LENGTH];
+volatile uint8_t NECIR_sendHead; // initialized to zero by default
+uint8_t NECIR_sendTail; // initialized to zero by default
+#endif // NECIR_TX
+#if (NECIR_CAPTURE)
+volatile uint8_t NECIR_captureBuffer[NECIR_CAPTURE_LENGTH];
+uint8_t NECIR_captureHead; // initialized to zero by default
+volatile uint8_t NECIR_captureTail; // initialized to zero by default
+volatile bool NECIR_captureOverflow;
+#endif // NECIR_CAPTURE
 
-#if (NECIR_USE_GPIOR0)
-#define NECIR_FLAGS GPIOR0
-#else // NECIR_USE_GPIOR0
-static bool NECIR_repeatTimeoutFlag;
-#endif // NECIR_USE_GPIOR0
+#if (NECIR_ASM_ISR)
+#if (NECIR_DECODE_MODE != 0 || NECIR_LOW_POWER || !NECIR_USE_GPIOR0)
+#error "NECIR_ASM_ISR requires NECIR_DECODE_MODE = 0, NECIR_LOW_POWER = 0 and NECIR_USE_GPIOR0 = 1"
+#endif // NECIR_DECODE_MODE || NECIR_LOW_POWER || NECIR_USE_GPIOR0
+#ifdef NECIR_ADDRESS_FILTER
+#error "NECIR_ADDRESS_FILTER is not supported by NECIR_ASM_ISR"
+#endif // NECIR_ADDRESS_FILTER
+#if (NECIR_COALESCE_REPEATS)
+#error "NECIR_COALESCE_REPEATS is not supported by NECIR_ASM_ISR"
+#endif // NECIR_COALESCE_REPEATS
+#if (NECIR_STATS)
+#error "NECIR_STATS is not supported by NECIR_ASM_ISR"
+#endif // NECIR_STATS
+#elif (NECIR_CHANNEL_MASK)
+// One decoder per channel, in the order of the pins in NECIR_CHANNEL_MASK
+static necir_decoder_t NECIR_decoders[NECIR_CHANNELS];
+#else // NECIR_ASM_ISR
+// Decoder state, shared between the interrupt routines below
+static necir_decoder_t NECIR_decoder;
+#endif // NECIR_ASM_ISR
+
+#if (NECIR_EVENTS)
+// The key last pressed on a channel, until its release has been queued
+typedef struct {
+  necir_message_t message;
+#if (NECIR_PROTOCOL_COUNT > 1)
+  uint8_t protocol;
+#endif // NECIR_PROTOCOL_COUNT
+  bool held;
+} necir_key_t;
+
+#if (NECIR_CHANNEL_MASK)
+static necir_key_t NECIR_keys[NECIR_CHANNELS];
+#define NECIR_KEY(d) (&NECIR_keys[(d) - NECIR_decoders])
+#else // NECIR_CHANNEL_MASK
+static necir_key_t NECIR_key;
+#define NECIR_KEY(d) ((void)(d), &NECIR_key)
+#endif // NECIR_CHANNEL_MASK
+#endif // NECIR_EVENTS
 
+#if (!NECIR_CHANNEL_MASK)
+// The repeat timeout flag lives in GPIOR0 if NECIR_USE_GPIOR0 = 1, otherwise in NECIR_decoder
 static inline void NECIR_SetRepeatTimeoutFlag(void) __attribute__(( always_inline ));
 static inline void NECIR_SetRepeatTimeoutFlag(void) {
-#if (NECIR_USE_GPIOR0)
-  setHigh(NECIR_FLAGS, NECIR_FLAG_REPEAT_TIMEOUT);
-#else // NECIR_USE_GPIOR0
-  NECIR_repeatTimeoutFlag = true;
-#endif // NECIR_USE_GPIOR0
+  NECIR_CORE_SET_REPEAT_TIMEOUT_FLAG(&NECIR_decoder);
 }
 static inline void NECIR_ClearRepeatTimeoutFlag(void) __attribute__(( always_inline ));
 static inline void NECIR_ClearRepeatTimeoutFlag(void) {
-#if (NECIR_USE_GPIOR0)
-  setLow(NECIR_FLAGS, NECIR_FLAG_REPEAT_TIMEOUT);
-#else // NECIR_USE_GPIOR0
-  NECIR_repeatTimeoutFlag = false;
-#endif // NECIR_USE_GPIOR0
+  NECIR_CORE_CLEAR_REPEAT_TIMEOUT_FLAG(&NECIR_decoder);
 }
 static inline bool NECIR_GetRepeatTimeoutFlag(void) __attribute__(( always_inline ));
 static inline bool NECIR_GetRepeatTimeoutFlag(void) {
-#if (NECIR_USE_GPIOR0)
-  return getValue(NECIR_FLAGS, NECIR_FLAG_REPEAT_TIMEOUT);
-#else // NECIR_USE_GPIOR0
-  return NECIR_repeatTimeoutFlag;
-#endif // NECIR_USE_GPIOR0
+  return NECIR_CORE_GET_REPEAT_TIMEOUT_FLAG(&NECIR_decoder);
 }
+#endif // NECIR_CHANNEL_MASK
+
+#if (!NECIR_ASM_ISR)
+#if (NECIR_DECODE_MODE == 1)
+static uint8_t timeHigh; // upper byte of the 16-bit edge timestamp, advanced by the timer overflow interrupt
+static uint16_t lastEdge; // timestamp of the previous edge
+static uint8_t lastSample; // level of IR_PIN after the previous edge, used to ignore changes on the other pins of the port
+#endif // NECIR_DECODE_MODE
 
-static inline bool NECIR_EnqueueMessageIfNotFull(uint8_t *message) __attribute__(( always_inline ));
-static inline bool NECIR_EnqueueMessageIfNotFull(uint8_t *message) {
+#if (NECIR_STATS || NECIR_EVENTS)
+// Counts and timestamps a message or repeat that NECIR_EnqueueMessageIfNotFull() put on the queue at 'tail'
+static inline void NECIR_MessageEnqueued(necir_decoder_t *d, uint8_t tail, bool isRepeat) __attribute__(( always_inline ));
+static inline void NECIR_MessageEnqueued(necir_decoder_t *d, uint8_t tail, bool isRepeat) {
+#if (NECIR_STATS)
+  if (isRepeat)
+    NECIR_STATS_COUNT(d, repeats);
+  else
+    NECIR_STATS_COUNT(d, messages);
+  uint8_t entries = (tail + NELEMS(NECIR_messageQueue) - NECIR_head) % NELEMS(NECIR_messageQueue) + 1; // including the new one
+  if (entries > d->stats.queueHighWater)
+    d->stats.queueHighWater = entries;
+#endif // NECIR_STATS
+#if (NECIR_EVENTS)
+  NECIR_timestampQueue[tail] = NECIR_ticks;
+  if (isRepeat)
+    NECIR_keyQueue[tail] = NECIR_KEY_REPEAT;
+  else { // a new key, which is released once its repeat timeout expires
+    necir_key_t *key = NECIR_KEY(d);
+    NECIR_keyQueue[tail] = NECIR_KEY_PRESS;
+    key->message = NECIR_messageQueue[tail];
+#if (NECIR_PROTOCOL_COUNT > 1)
+    key->protocol = NECIR_protocolQueue[tail];
+#endif // NECIR_PROTOCOL_COUNT
+    key->held = true;
+  }
+#endif // NECIR_EVENTS
+}
+#endif // NECIR_STATS || NECIR_EVENTS
+
+static inline bool NECIR_EnqueueMessageIfNotFull(necir_decoder_t *d, bool isRepeat) __attribute__(( always_inline ));
+static inline bool NECIR_EnqueueMessageIfNotFull(necir_decoder_t *d, bool isRepeat) {
   uint8_t tail = NECIR_tail; // cache volatile NECIR_tail, since this function is only ever called from inside the ISR
+#if (!NECIR_STATS && !NECIR_EVENTS)
+  (void)isRepeat; // only counted and timestamped
+#endif // NECIR_STATS || NECIR_EVENTS
   if (NECIR_head != (tail + 1) % NELEMS(NECIR_messageQueue)) { // same as if (!NECIR_QueueFull()) ... but uses cached tail
+#if (NECIR_PROTOCOL_COUNT > 1)
+    NECIR_protocolQueue[tail] = NECIR_DecoderProtocol(d);
+#endif // NECIR_PROTOCOL_COUNT
+    if (NECIR_DecoderProtocol(d) != NECIR_NEC) { // the other protocols have their own bit layouts, so let the core convert them
+      uint32_t value;
+      if (!NECIR_DecoderValue(d, &value)) {
+        NECIR_STATS_COUNT(d, invalid);
+        return false; // validation failed, we dropped the message, do not call NECIR_EnqueueRepeat()
+      }
+      NECIR_messageQueue[tail] = value;
+#if (NECIR_STATS || NECIR_EVENTS)
+      NECIR_MessageEnqueued(d, tail, isRepeat);
+#endif // NECIR_STATS || NECIR_EVENTS
+      return true; // return success, NECIR_EnqueueRepeat() needs to be called next
+    }
+    uint8_t *message = d->message;
 #if (NECIR_USE_EXTENDED_PROTOCOL)
     uint8_t *p = (uint8_t*)&NECIR_messageQueue[tail];
     *p++ = message[3]; // as fast as: NECIR_messageQueue[tail] =
@@ -102,11 +286,22 @@ static inline bool NECIR_EnqueueMessageIfNotFull(uint8_t *message) {
       uint8_t *p = (uint8_t*)&NECIR_messageQueue[tail];
       *p++ = message[2]; // faster than: NECIR_messageQueue[tail] =
       *p = message[0];   //                ((uint16_t)message[0] << 8) | message[2];
-    } else
+    } else {
+      NECIR_STATS_COUNT(d, invalid);
       return false; // validation failed, we dropped the message, do not call NECIR_EnqueueRepeat()
+    }
 #endif // NECIR_USE_EXTENDED_PROTOCOL
+#if (NECIR_STATS || NECIR_EVENTS)
+    NECIR_MessageEnqueued(d, tail, isRepeat);
+#endif // NECIR_STATS || NECIR_EVENTS
     return true; // return success, NECIR_EnqueueRepeat() needs to be called next
   }
+#if (NECIR_STATS)
+  if (isRepeat)
+    NECIR_STATS_COUNT(d, repeatsDropped);
+  else
+    NECIR_STATS_COUNT(d, messagesDropped);
+#endif // NECIR_STATS
   return false; // the queue was full, we dropped the message, do not call NECIR_EnqueueRepeat()
 }
 
@@ -114,25 +309,390 @@ static inline bool NECIR_EnqueueMessageIfNotFull(uint8_t *message) {
 static inline void NECIR_EnqueueRepeat(bool isRepeat) __attribute__(( always_inline ));
 static inline void NECIR_EnqueueRepeat(bool isRepeat) {
   uint8_t tail = NECIR_tail; // cache volatile NECIR_tail, since this function is only ever called from inside the ISR
+#if (NECIR_COALESCE_REPEATS)
+  NECIR_repeatCountQueue[tail] = isRepeat;
+#else // NECIR_COALESCE_REPEATS
   if (isRepeat)
     NECIR_repeatFlagQueue[tail / 8] |= pgm_read_byte(&NECIR_oneLeftShiftedBy[tail % 8]);
   else
     NECIR_repeatFlagQueue[tail / 8] &= pgm_read_byte(&NECIR_oneLeftShiftedBy[tail % 8]) ^ 0xFF;
+#endif // NECIR_COALESCE_REPEATS
   NECIR_tail = (tail + 1) % NELEMS(NECIR_messageQueue);
 }
 
+// Called whenever the decoder returns NECIR_EVENT_IDLE, which it does once
+// the repeat timeout has expired. Queues the release of the key last pressed
+// on the decoder's channel, if that hasn't been done yet. Returns false if
+// the queue was full, in which case the next NECIR_EVENT_IDLE tries again.
+static inline bool NECIR_ReleaseHeldKey(necir_decoder_t *d) __attribute__(( always_inline ));
+static inline bool NECIR_ReleaseHeldKey(necir_decoder_t *d) {
+#if (NECIR_EVENTS)
+  necir_key_t *key = NECIR_KEY(d);
+  if (!key->held)
+    return true;
+  uint8_t tail = NECIR_tail; // cache volatile NECIR_tail, since this function is only ever called from inside the ISR
+  if (NECIR_head == (tail + 1) % NELEMS(NECIR_messageQueue)) // same as if (NECIR_QueueFull()) ... but uses cached tail
+    return false;
+  NECIR_messageQueue[tail] = key->message;
+  NECIR_keyQueue[tail] = NECIR_KEY_RELEASE;
+  NECIR_timestampQueue[tail] = NECIR_ticks;
+#if (NECIR_CHANNEL_MASK)
+  NECIR_channelQueue[tail] = d - NECIR_decoders;
+#endif // NECIR_CHANNEL_MASK
+#if (NECIR_PROTOCOL_COUNT > 1)
+  NECIR_protocolQueue[tail] = key->protocol;
+#endif // NECIR_PROTOCOL_COUNT
+  key->held = false;
+  NECIR_EnqueueRepeat(false);
+#else // NECIR_EVENTS
+  (void)d;
+#endif // NECIR_EVENTS
+  return true;
+}
+
+#if (NECIR_COALESCE_REPEATS)
+// Counts a repeat on the newest queue entry instead of taking a new one, if
+// that entry holds unread repeats of the same message, and returns true if
+// it did. This works even when the queue is full. The entry at NECIR_head is
+// left alone, since main() may be in the middle of dequeueing it.
+static inline bool NECIR_CoalesceRepeat(necir_decoder_t *d) __attribute__(( always_inline ));
+static inline bool NECIR_CoalesceRepeat(necir_decoder_t *d) {
+  uint8_t tail = NECIR_tail; // cache volatile NECIR_tail, since this function is only ever called from inside the ISR
+  uint8_t newest = (tail ? tail : NELEMS(NECIR_messageQueue)) - 1;
+  if (tail == NECIR_head || newest == NECIR_head) // fewer than two unread entries
+    return false;
+  uint8_t count = NECIR_repeatCountQueue[newest];
+  uint32_t value;
+  if (!count || !NECIR_DecoderValue(d, &value) || NECIR_messageQueue[newest] != (necir_message_t)value)
+    return false; // not a repeat entry, or a different message
+#if (NECIR_CHANNEL_MASK)
+  if (NECIR_channelQueue[newest] != d - NECIR_decoders)
+    return false;
+#endif // NECIR_CHANNEL_MASK
+#if (NECIR_PROTOCOL_COUNT > 1)
+  if (NECIR_protocolQueue[newest] != NECIR_DecoderProtocol(d))
+    return false;
+#endif // NECIR_PROTOCOL_COUNT
+  if (count != 255) // saturate rather than wrap around to a new message
+    NECIR_repeatCountQueue[newest] = count + 1;
+#if (NECIR_EVENTS)
+  NECIR_timestampQueue[newest] = NECIR_ticks; // the time of the last repeat
+#endif // NECIR_EVENTS
+  NECIR_STATS_COUNT(d, repeats);
+  return true;
+}
+#endif // NECIR_COALESCE_REPEATS
+#endif // NECIR_ASM_ISR
+
+#if (NECIR_TX)
+// Timer1 toggles OC1A (PB1) on every compare match, so it runs at twice the carrier frequency
+#define NECIR_TX_DDR DDRB
+#define NECIR_TX_PIN PB1
+#define NECIR_TX_CARRIER 38000
+#ifdef TCCR1A // ATmega328P: 16-bit Timer1, CTC with OCR1A as TOP
+#define NECIR_TX_OCR ((uint16_t)((F_CPU + NECIR_TX_CARRIER) / (2 * NECIR_TX_CARRIER)) - 1)
+#define NECIR_CarrierOn() (TCCR1A = (1 << COM1A0))
+#define NECIR_CarrierOff() (TCCR1A = 0) // OC1A goes back to PORTB, which is low
+#else // TCCR1A: ATtiny85: 8-bit Timer1, CTC with OCR1C as TOP
+#if ((F_CPU + NECIR_TX_CARRIER) / (2 * NECIR_TX_CARRIER) <= 256)
+#define NECIR_TX_PRESCALE 1
+#define NECIR_TX_CLOCK_SELECT (1 << CS10) // CK
+#else // F_CPU
+#define NECIR_TX_PRESCALE 2
+#define NECIR_TX_CLOCK_SELECT (1 << CS11) // CK/2
+#endif // F_CPU
+#define NECIR_TX_OCR ((uint8_t)((F_CPU / NECIR_TX_PRESCALE + NECIR_TX_CARRIER) / (2 * NECIR_TX_CARRIER)) - 1)
+#define NECIR_CarrierOn() (TCCR1 = (1 << CTC1) | (1 << COM1A0) | NECIR_TX_CLOCK_SELECT)
+#define NECIR_CarrierOff() (TCCR1 = (1 << CTC1) | NECIR_TX_CLOCK_SELECT) // OC1A goes back to PORTB, which is low
+#endif // TCCR1A
+
+// Marks and spaces in samples, rounded to the nearest
+#define NECIR_TX_SAMPLES(t) ((uint8_t)(((uint32_t)(t) * (uint32_t)(F_CPU / 1000) + (uint32_t)NECIR_SAMPLE_CYCLES * 5000) / ((uint32_t)NECIR_SAMPLE_CYCLES * 10000)))
+// From the start of one frame or repeat code to the start of the next
+#define NECIR_TX_PERIOD ((uint16_t)(((uint32_t)108 * (F_CPU / 1000) + NECIR_SAMPLE_CYCLES / 2) / NECIR_SAMPLE_CYCLES))
+
+enum {
+  NECIR_TX_IDLE,
+  NECIR_TX_LEADER,
+  NECIR_TX_PAUSE,
+  NECIR_TX_BIT_MARK,
+  NECIR_TX_BIT_SPACE,
+  NECIR_TX_STOP,
+  NECIR_TX_GAP,
+};
+
+static uint8_t txState;
+static uint8_t txCounter; // samples left in the current mark or space
+static uint16_t txPeriodCounter; // samples left until the next frame or repeat code may begin
+static uint8_t txBitCounter; // bits sent so far; NECIR_NEC_BITS for a repeat code, which has none
+static uint8_t txRepeats; // repeat codes left to send after the current one
+static uint8_t txMessage[4]; // in the order they are sent, each LSB-first
+
+// Takes the next message off the send queue
+static inline void NECIR_TransmitLoad(void) __attribute__(( always_inline ));
+static inline void NECIR_TransmitLoad(void) {
+  uint8_t head = NECIR_sendHead; // cache volatile NECIR_sendHead, since this function is only ever called from inside the ISR
+  necir_message_t message = NECIR_sendQueue[head];
+#if (NECIR_USE_EXTENDED_PROTOCOL)
+  txMessage[0] = message >> 24; // the reverse of NECIR_EnqueueMessageIfNotFull()
+  txMessage[1] = message >> 16;
+  txMessage[2] = message >> 8;
+  txMessage[3] = message;
+#else // NECIR_USE_EXTENDED_PROTOCOL
+  txMessage[0] = message >> 8; // address
+  txMessage[1] = txMessage[0] ^ 0xFF;
+  txMessage[2] = message; // command
+  txMessage[3] = txMessage[2] ^ 0xFF;
+#endif // NECIR_USE_EXTENDED_PROTOCOL
+  txRepeats = NECIR_sendRepeatsQueue[head];
+  txBitCounter = 0;
+  NECIR_sendHead = (head + 1) % NELEMS(NECIR_sendQueue);
+}
+
+// Begins the leader of a frame or repeat code
+static inline void NECIR_TransmitLeader(void) __attribute__(( always_inline ));
+static inline void NECIR_TransmitLeader(void) {
+  NECIR_CarrierOn();
+  txCounter = NECIR_TX_SAMPLES(NECIR_NEC_LEADER);
+  txPeriodCounter = NECIR_TX_PERIOD;
+  txState = NECIR_TX_LEADER;
+}
+
+// Sends the next sample's worth of marks and spaces. Returns true while
+// sending, in which case the receiver must skip this sample, since it would
+// only hear the transmitter.
+static inline bool NECIR_TransmitStep(void) __attribute__(( always_inline ));
+static inline bool NECIR_TransmitStep(void) {
+  switch (txState) {
+  case NECIR_TX_IDLE:
+    if (NECIR_sendHead == NECIR_sendTail)
+      return false; // nothing to send
+    NECIR_TransmitLoad();
+    NECIR_TransmitLeader();
+    return true;
+  case NECIR_TX_GAP:
+    if (--txPeriodCounter)
+      return true;
+    if (txRepeats) { // send the next repeat code
+      --txRepeats;
+      txBitCounter = NECIR_NEC_BITS;
+      NECIR_TransmitLeader();
+      return true;
+    }
+    // Done, so start receiving again from a clean state
+    txState = NECIR_TX_IDLE;
+#if (NECIR_CHANNEL_MASK)
+    for (uint8_t channel = 0; channel < NECIR_CHANNELS; ++channel)
+      NECIR_decoders[channel].state = NECIR_STATE_WAITING_FOR_IDLE;
+#else // NECIR_CHANNEL_MASK
+    NECIR_decoder.state = NECIR_STATE_WAITING_FOR_IDLE;
+#endif // NECIR_CHANNEL_MASK
+    return true;
+  }
+
+  --txPeriodCounter;
+  if (--txCounter) // the current mark or space isn't over yet
+    return true;
+  switch (txState) {
+  case NECIR_TX_LEADER:
+    NECIR_CarrierOff();
+    txCounter = txBitCounter == NECIR_NEC_BITS ? NECIR_TX_SAMPLES(NECIR_NEC_REPEAT_PAUSE) : NECIR_TX_SAMPLES(NECIR_NEC_PAUSE);
+    txState = NECIR_TX_PAUSE;
+    break;
+  case NECIR_TX_PAUSE:
+  case NECIR_TX_BIT_SPACE: // followed by the burst of the next bit, or the final burst
+    NECIR_CarrierOn();
+    txCounter = NECIR_TX_SAMPLES(NECIR_NEC_BIT);
+    txState = txBitCounter < NECIR_NEC_BITS ? NECIR_TX_BIT_MARK : NECIR_TX_STOP;
+    break;
+  case NECIR_TX_BIT_MARK:
+    NECIR_CarrierOff();
+    if (txMessage[txBitCounter / 8] & pgm_read_byte(&NECIR_oneLeftShiftedBy[txBitCounter % 8]))
+      txCounter = NECIR_TX_SAMPLES(NECIR_NEC_ONE_PAUSE);
+    else
+      txCounter = NECIR_TX_SAMPLES(NECIR_NEC_BIT);
+    ++txBitCounter;
+    txState = NECIR_TX_BIT_SPACE;
+    break;
+  case NECIR_TX_STOP:
+    NECIR_CarrierOff();
+    txState = NECIR_TX_GAP;
+    break;
+  }
+  return true;
+}
+#endif // NECIR_TX
+
+#if (NECIR_CAPTURE)
+static uint8_t captureLevel = NECIR_CAPTURE_SPACE; // level of the run in progress, the IR signal starts out idle
+static uint16_t captureSamples; // length of the run in progress, saturating
+
+// Writes the run that just ended into the capture buffer, or drops it if it doesn't fit
+static inline void NECIR_CaptureRun(void) __attribute__(( always_inline ));
+static inline void NECIR_CaptureRun(void) {
+  uint8_t tail = NECIR_captureTail; // cache volatile NECIR_captureTail, since this function is only ever called from inside the ISR
+  uint8_t bytes = captureSamples < 64 ? 1 : (captureSamples < 8192 ? 2 : 3);
+  if ((NECIR_captureHead + NELEMS(NECIR_captureBuffer) - tail - 1) % NELEMS(NECIR_captureBuffer) < bytes) {
+    NECIR_captureOverflow = true;
+    return;
+  }
+  NECIR_captureBuffer[tail] = captureLevel | (bytes > 1 ? NECIR_CAPTURE_MORE : 0) | (captureSamples & 0x3F);
+  tail = (tail + 1) % NELEMS(NECIR_captureBuffer);
+  if (bytes > 1) {
+    NECIR_captureBuffer[tail] = (bytes > 2 ? 0x80 : 0) | ((captureSamples >> 6) & 0x7F);
+    tail = (tail + 1) % NELEMS(NECIR_captureBuffer);
+    if (bytes > 2) {
+      NECIR_captureBuffer[tail] = captureSamples >> 13;
+      tail = (tail + 1) % NELEMS(NECIR_captureBuffer);
+    }
+  }
+  NECIR_captureTail = tail;
+}
+
+// Called with every sample, measures runs of the same level
+static inline void NECIR_CaptureSample(uint8_t sample) __attribute__(( always_inline ));
+static inline void NECIR_CaptureSample(uint8_t sample) {
+  uint8_t level = sample ? NECIR_CAPTURE_SPACE : 0;
+  if (level == captureLevel) {
+    if (captureSamples != UINT16_MAX)
+      ++captureSamples;
+  } else {
+    if (captureSamples) // there is no run before the first sample
+      NECIR_CaptureRun();
+    captureLevel = level;
+    captureSamples = 1;
+  }
+}
+#endif // NECIR_CAPTURE
+
+#if (NECIR_SCHEDULER)
+_Static_assert(F_CPU / 1000 + NECIR_SAMPLE_CYCLES <= UINT16_MAX, "a millisecond does not fit the 16-bit fraction of the clock");
+
+// Called with every sample, advances the millisecond clock and flags the
+// tasks when the earliest one is due. A sample period is always shorter than
+// a millisecond, so at most one millisecond completes per sample.
+static inline void NECIR_ClockStep(void) __attribute__(( always_inline ));
+static inline void NECIR_ClockStep(void) {
+  uint16_t fraction = NECIR_millisFraction + NECIR_SAMPLE_CYCLES;
+  if (fraction >= F_CPU / 1000) {
+    fraction -= F_CPU / 1000;
+    uint32_t millis = NECIR_millis + 1;
+    NECIR_millis = millis;
+    if ((uint16_t)millis == NECIR_taskDue)
+      NECIR_taskPending = true;
+  }
+  NECIR_millisFraction = fraction;
+}
+#endif // NECIR_SCHEDULER
+
+// Clock select bits for the NECIR_CTC_PRESCALE that necir_timing.h picked
+#if (NECIR_ISR_CTC_TIMER == 0)
+#if (NECIR_CTC_PRESCALE == 1)
+#define NECIR_CLOCK_SELECT (1 << CS00) // clk_io (No prescaling)
+#elif (NECIR_CTC_PRESCALE == 8)
+#define NECIR_CLOCK_SELECT (1 << CS01) // clk_io/8 (From prescaler)
+#elif (NECIR_CTC_PRESCALE == 64)
+#define NECIR_CLOCK_SELECT ((1 << CS01) | (1 << CS00)) // clk_io/64 (From prescaler)
+#elif (NECIR_CTC_PRESCALE == 256)
+#define NECIR_CLOCK_SELECT (1 << CS02) // clk_io/256 (From prescaler)
+#else // NECIR_CTC_PRESCALE
+#define NECIR_CLOCK_SELECT ((1 << CS02) | (1 << CS00)) // clk_io/1024 (From prescaler)
+#endif // NECIR_CTC_PRESCALE
+#elif (NECIR_ISR_CTC_TIMER == 2)
+#if (NECIR_CTC_PRESCALE == 1)
+#define NECIR_CLOCK_SELECT (1 << CS20) // clk_T2S (No prescaling)
+#elif (NECIR_CTC_PRESCALE == 8)
+#define NECIR_CLOCK_SELECT (1 << CS21) // clk_T2S/8 (From prescaler)
+#elif (NECIR_CTC_PRESCALE == 64)
+#define NECIR_CLOCK_SELECT (1 << CS22) // clk_T2S/64 (From prescaler)
+#elif (NECIR_CTC_PRESCALE == 256)
+#define NECIR_CLOCK_SELECT ((1 << CS22) | (1 << CS21)) // clk_T2S/256 (From prescaler)
+#else // NECIR_CTC_PRESCALE
+#define NECIR_CLOCK_SELECT ((1 << CS22) | (1 << CS21) | (1 << CS20)) // clk_T2S/1024 (From prescaler)
+#endif // NECIR_CTC_PRESCALE
+#endif // NECIR_ISR_CTC_TIMER
+
+#if (NECIR_DECODE_MODE == 1 || NECIR_LOW_POWER)
+#if (NECIR_ISR_CTC_TIMER == 0)
+#define NECIR_TCCRB TCCR0B
+#define NECIR_TCNT TCNT0
+#define NECIR_TOIE TOIE0
+#define NECIR_TOV TOV0
+#ifdef TIMSK0
+#define NECIR_TIMSK TIMSK0
+#define NECIR_TIFR TIFR0
+#else // TIMSK0
+#define NECIR_TIMSK TIMSK
+#define NECIR_TIFR TIFR
+#endif // TIMSK0
+#define NECIR_TIMER_OVF_vect TIMER0_OVF_vect
+#elif (NECIR_ISR_CTC_TIMER == 2)
+#define NECIR_TCCRB TCCR2B
+#define NECIR_TCNT TCNT2
+#define NECIR_TOIE TOIE2
+#define NECIR_TOV TOV2
+#define NECIR_TIMSK TIMSK2
+#define NECIR_TIFR TIFR2
+#define NECIR_TIMER_OVF_vect TIMER2_OVF_vect
+#else // NECIR_ISR_CTC_TIMER
+#error "NECIR_ISR_CTC_TIMER must be 0 or 2"
+#endif // NECIR_ISR_CTC_TIMER
+
+#define NECIR_CONCAT3_(a, b, c) a ## b ## c
+#define NECIR_CONCAT3(a, b, c) NECIR_CONCAT3_(a, b, c)
+
+#ifdef PCICR
+#define NECIR_PCICR PCICR
+#define NECIR_PCIE NECIR_CONCAT3(PCIE, IR_PCINT_GROUP, )
+#define NECIR_PCMSK NECIR_CONCAT3(PCMSK, IR_PCINT_GROUP, )
+#define NECIR_PCINT_vect NECIR_CONCAT3(PCINT, IR_PCINT_GROUP, _vect)
+#else // PCICR
+#define NECIR_PCICR GIMSK
+#define NECIR_PCIE PCIE
+#define NECIR_PCMSK PCMSK
+#define NECIR_PCINT_vect PCINT0_vect
+#endif // PCICR
+#endif // NECIR_DECODE_MODE || NECIR_LOW_POWER
+
+#if (NECIR_LOW_POWER)
+// Set right before the CPU enters power-down, and cleared as soon as it
+// wakes up, so the pin change interrupt knows whether the first edge of a
+// leader was delayed by the oscillator start-up time.
+static volatile bool poweredDown;
+#endif // NECIR_LOW_POWER
+
+#if (NECIR_DECODE_MODE == 1)
+// Returns the current 16-bit edge timestamp. Only call this from inside an
+// interrupt, and only rely on it while the overflow interrupt is enabled.
+static inline uint16_t NECIR_Timestamp(void) __attribute__(( always_inline ));
+static inline uint16_t NECIR_Timestamp(void) {
+  uint8_t low = NECIR_TCNT;
+  uint8_t high = timeHigh;
+  if ((NECIR_TIFR & (1 << NECIR_TOV)) && !(low & 0x80)) // the timer overflowed, but the overflow interrupt hasn't run yet
+    ++high;
+  return ((uint16_t)high << 8) | low;
+}
+#endif // NECIR_DECODE_MODE
+
 void NECIR_Init(void)
 {
+#if (NECIR_CHANNEL_MASK)
+  // Set every channel pin as input and enable pullups
+  IR_DDR &= ~NECIR_CHANNEL_MASK;
+  IR_PORT |= NECIR_CHANNEL_MASK;
+#else // NECIR_CHANNEL_MASK
   // Set IR pin as input and enable pullup
   setInput(IR_DDR, IR_PIN);
   enablePullup(IR_PORT, IR_PIN);
+#endif // NECIR_CHANNEL_MASK
 
+#if (NECIR_DECODE_MODE == 0)
 #if (NECIR_ISR_CTC_TIMER == 0)
   // CTC with OCR0A as TOP
   TCCR0A = (1 << WGM01);
-  // clk_io/64 (From prescaler)
-  TCCR0B = (1 << CS01) | (1 << CS00);
-  // Generate an interrupt every (NECIR_CTC_TOP + 1) * 64 clock cycles
+  // clk_io/NECIR_CTC_PRESCALE (From prescaler)
+  TCCR0B = NECIR_CLOCK_SELECT;
+  // Generate an interrupt every NECIR_SAMPLE_CYCLES clock cycles
   OCR0A = NECIR_CTC_TOP;
 
   // Enable Timer/Counter0 Compare Match A interrupt
@@ -145,9 +705,9 @@ void NECIR_Init(void)
 #elif (NECIR_ISR_CTC_TIMER == 2)
   // CTC with OCR2A as TOP
   TCCR2A = (1 << WGM21);
-  // clk_io/64 (From prescaler)
-  TCCR2B = (1 << CS22);
-  // Generate an interrupt every (NECIR_CTC_TOP + 1) * 64 clock cycles
+  // clk_T2S/NECIR_CTC_PRESCALE (From prescaler)
+  TCCR2B = NECIR_CLOCK_SELECT;
+  // Generate an interrupt every NECIR_SAMPLE_CYCLES clock cycles
   OCR2A = NECIR_CTC_TOP;
   // Enable Timer/Counter2 Compare Match A interrupt
   TIMSK2 |= (1 << OCIE2A);
@@ -155,10 +715,71 @@ void NECIR_Init(void)
 #error "NECIR_ISR_CTC_TIMER must be 0 or 2"
 #endif // NECIR_ISR_CTC_TIMER
 
+#if (NECIR_ASM_ISR)
+  // Start in the WAITING_FOR_IDLE state with a cleared sample counter, since
+  // necir_isr.S keeps both in I/O registers
+  GPIOR1 = 0;
+  GPIOR2 = 0;
+  setLow(NECIR_FLAGS, NECIR_FLAG_ASM_IDLE);
+#endif // NECIR_ASM_ISR
+
+#else // NECIR_DECODE_MODE
+#if (NECIR_ISR_CTC_TIMER == 0)
+  // Normal mode, the timer runs freely and is only used to timestamp edges
+  TCCR0A = 0;
+  // clk_io/NECIR_CTC_PRESCALE (From prescaler)
+  TCCR0B = NECIR_CLOCK_SELECT;
+#elif (NECIR_ISR_CTC_TIMER == 2)
+  // Normal mode, the timer runs freely and is only used to timestamp edges
+  TCCR2A = 0;
+  // clk_T2S/NECIR_CTC_PRESCALE (From prescaler)
+  TCCR2B = NECIR_CLOCK_SELECT;
+#endif // NECIR_ISR_CTC_TIMER
+
+  // Start in the state that matches the current level of the IR pin
+  lastSample = inputState(IR_INPUT, IR_PIN);
+  if (lastSample)
+    NECIR_decoder.state = NECIR_STATE_IDLE;
+
+  // Enable the pin change interrupt for IR_PIN. The timer overflow
+  // interrupt is only enabled while there is something to time.
+  NECIR_PCMSK |= (1 << IR_PIN);
+  NECIR_PCICR |= (1 << NECIR_PCIE);
+#endif // NECIR_DECODE_MODE
+
+#if (NECIR_TX)
+  // Timer1 generates the carrier, but OC1A is only connected to the pin during marks
+  setLow(PORTB, NECIR_TX_PIN);
+  setOutput(NECIR_TX_DDR, NECIR_TX_PIN);
+#ifdef TCCR1A
+  TCCR1B = (1 << WGM12) | (1 << CS10); // CTC with OCR1A as TOP, clk_io/1
+  OCR1A = NECIR_TX_OCR;
+#else // TCCR1A
+  OCR1C = NECIR_TX_OCR;
+  OCR1A = 0;
+#endif // TCCR1A
+  NECIR_CarrierOff();
+#endif // NECIR_TX
+
   // Disallow repeats until a valid command has been seen
+#if (NECIR_CHANNEL_MASK)
+  for (uint8_t channel = 0; channel < NECIR_CHANNELS; ++channel)
+    NECIR_DecoderInit(&NECIR_decoders[channel]);
+#elif (NECIR_ADAPTIVE)
+  NECIR_DecoderInit(&NECIR_decoder); // also starts the running average of the leader at 9ms
+#else // NECIR_CHANNEL_MASK
   NECIR_SetRepeatTimeoutFlag();
+#endif // NECIR_CHANNEL_MASK
+
+#if (NECIR_SCHEDULER)
+  NECIR_taskPending = true; // every task runs on the first call to NECIR_RunTasks()
+#endif // NECIR_SCHEDULER
 }
 
+#if (NECIR_ASM_ISR)
+// The sampling interrupt is implemented in necir_isr.S
+#elif (NECIR_DECODE_MODE == 0)
+
 #if (NECIR_ISR_CTC_TIMER == 0)
 #define NECIR_TIMER_COMPA_vect TIMER0_COMPA_vect
 #elif (NECIR_ISR_CTC_TIMER == 2)
@@ -167,140 +788,539 @@ void NECIR_Init(void)
 #error "NECIR_ISR_CTC_TIMER must be 0 or 2"
 #endif // NECIR_ISR_CTC_TIMER
 
-// This interrupt will get called every (NECIR_CTC_TOP + 1) * 64 clock cycles
-ISR(NECIR_TIMER_COMPA_vect)
+#if (NECIR_LOW_POWER)
+// Restarts the sampling timer from the falling edge that begins a leader.
+// The timer is preloaded so the first sample is taken half a sample period
+// after the edge, which is on average when the running sampler would have
+// noticed it, and the oscillator start-up time is added to the leader if the
+// edge woke the CPU from power-down.
+static inline void NECIR_StartSampling(void) __attribute__(( always_inline ));
+static inline void NECIR_StartSampling(void) {
+  NECIR_PCICR &= ~(1 << NECIR_PCIE); // sampling takes over from the pin change interrupt
+  NECIR_TCNT = NECIR_CTC_TOP / 2;
+  NECIR_TCCRB = NECIR_CLOCK_SELECT;
+#if (NECIR_CHANNEL_MASK)
+  uint8_t input = IR_INPUT;
+  necir_decoder_t *d = NECIR_decoders;
+  for (uint8_t bit = 1; bit; bit <<= 1) // every channel that is low now begins a leader
+    if (NECIR_CHANNEL_MASK & bit) {
+      if (!(input & bit)) {
+        d->stateCounter = poweredDown ? NECIR_WAKEUP_SAMPLES : 0;
+        d->state = NECIR_STATE_LEADER;
+      }
+      ++d;
+    }
+#else // NECIR_CHANNEL_MASK
+  NECIR_decoder.stateCounter = poweredDown ? NECIR_WAKEUP_SAMPLES : 0;
+  NECIR_decoder.state = NECIR_STATE_LEADER;
+#endif // NECIR_CHANNEL_MASK
+}
+
+// Stops the sampling timer and waits for the next falling edge on IR_PIN (or any channel pin)
+static inline void NECIR_StopSampling(void) __attribute__(( always_inline ));
+static inline void NECIR_StopSampling(void) {
+  NECIR_TCCRB = 0; // stop the timer, no clock source
+  NECIR_PCMSK |= NECIR_INPUT_MASK;
+  NECIR_PCICR |= (1 << NECIR_PCIE);
+  if ((IR_INPUT & NECIR_INPUT_MASK) != NECIR_INPUT_MASK) // IR went low after it was sampled, but before the pin change interrupt was armed
+    NECIR_StartSampling();
+}
+
+// Only armed while sampling is stopped
+ISR(NECIR_PCINT_vect)
 {
-  static enum { NECIR_STATE_WAITING_FOR_IDLE, NECIR_STATE_IDLE,
-                NECIR_STATE_LEADER, NECIR_STATE_PAUSE,
-                NECIR_STATE_BIT_LEADER, NECIR_STATE_BIT_PAUSE,
-                NECIR_STATE_PROCESS, NECIR_STATE_PROCESS2,
-                NECIR_STATE_REPEAT_PROCESS, NECIR_STATE_REPEAT_PROCESS2 } state;
-
-  static uint8_t stateCounter; // stores the number of times we have sampled the state minus one
-  static uint8_t bitCounter; // keeps track of how many bits we've currently decoded
-  static uint8_t messageBit; // we pre-calculate this value in the BIT_LEADER state, so the BIT_PAUSE state can execute faster
-  static uint16_t repeatTimeout; // timeout for when we no longer accept repeat codes for a given command
-  static uint8_t nativeRepeatsNeeded; // counts down the number of native repeat messages seen; when zero, emits a repeat to the application
-#if (NECIR_TURBO_MODE_AFTER != 0)
-  static uint8_t turboModeCounter;
-#endif // NECIR_TURBO_MODE_AFTER
-
-  static uint8_t message[4]; // stores the decoded bits
+  if ((IR_INPUT & NECIR_INPUT_MASK) != NECIR_INPUT_MASK) // only a falling edge can begin a leader
+    NECIR_StartSampling();
+}
+#endif // NECIR_LOW_POWER
 
-  uint8_t sample = inputState(IR_INPUT, IR_PIN);
+#if (NECIR_CHANNEL_MASK)
+// This interrupt will get called every NECIR_SAMPLE_CYCLES clock cycles.
+// The whole port is sampled at once, and each channel is stepped in turn.
+// Two channels can finish a message on the same sample, so each one enqueues
+// its message in one go instead of splitting it across the COMMIT event.
+ISR(NECIR_TIMER_COMPA_vect)
+{
+  uint8_t input = IR_INPUT;
+  necir_decoder_t *d = NECIR_decoders;
+#if (NECIR_LOW_POWER)
+  uint8_t idleChannels = 0;
+#endif // NECIR_LOW_POWER
+#if (NECIR_EVENTS || NECIR_SCHEDULER)
+  ++NECIR_ticks;
+#endif // NECIR_EVENTS || NECIR_SCHEDULER
+#if (NECIR_SCHEDULER)
+  NECIR_ClockStep();
+#endif // NECIR_SCHEDULER
+#if (NECIR_TX)
+  if (NECIR_TransmitStep()) // sending, every channel would only hear our own signal
+    return;
+#endif // NECIR_TX
+#if (NECIR_CAPTURE)
+  NECIR_CaptureSample(input & (NECIR_CHANNEL_MASK & -NECIR_CHANNEL_MASK)); // the lowest channel
+#endif // NECIR_CAPTURE
 
-  switch (state) {
-  case NECIR_STATE_WAITING_FOR_IDLE: // IR was low, waiting for high
-    if (sample) // if high now, switch to idle state
-      state = NECIR_STATE_IDLE;
-    break;
-  case NECIR_STATE_IDLE: // IR was high, waiting for low
-    // If we haven't hit the timeout for when we no longer accept repeats yet, decrement the timeout counter and check
-    if (!NECIR_GetRepeatTimeoutFlag() && --repeatTimeout == 0)
-      NECIR_SetRepeatTimeoutFlag();
-    if (!sample) { // if low now, reset the counter, and switch to leader state
-      stateCounter = 0;
-      state = NECIR_STATE_LEADER;
-    }
-    break;
-  case NECIR_STATE_LEADER: // IR was low, needs to be low for 9ms
-    if (!sample) { // if low now, make sure it hasn't been low for too long
-      if (++stateCounter > (uint8_t)NUM_SAMPLES_IN_MS(9.0) + 1)
-        state = NECIR_STATE_WAITING_FOR_IDLE; // low for too long, switch to wait for idle state
-    } else { // if high now, make sure that it was low for long enough
-      if (stateCounter < (uint8_t)NUM_SAMPLES_IN_MS(9.0) - 2)
-        state = NECIR_STATE_IDLE; // was not low for long enough, switch to idle state
-      else { // was low for 9ms, switch to pause state
-        stateCounter = 0;
-        state = NECIR_STATE_PAUSE;
-      }
-    }
-    break;
-  case NECIR_STATE_PAUSE: // IR was high, needs to be high for 4.5ms, or 2.25ms for repeat code
-    if (sample) { // if high now, make sure it hasn't been high for too long
-      if (++stateCounter > (uint8_t)NUM_SAMPLES_IN_MS(4.5) + 1)
-        state = NECIR_STATE_IDLE; // high for too long, switch to idle state
-    } else { // if low now, make sure that it was high for long enough
-      if (stateCounter < (uint8_t)NUM_SAMPLES_IN_MS(2.25) - 2) {
-        state = NECIR_STATE_WAITING_FOR_IDLE; // was not high for long enough, switch to wait for idle state
-        break;
-      } else if (stateCounter > (uint8_t)NUM_SAMPLES_IN_MS(2.25) + 1) { // was high for longer than a repeat code, so switch to bit leader state
-        repeatTimeout = (uint16_t)NUM_SAMPLES_IN_MS(110) + 1; // initialize to 110 - 9.0 - 2.25 - 0.5625 ms (idle time between repeats) + leeway
-        NECIR_ClearRepeatTimeoutFlag(); // since we are receiving a new message, allow repeat codes
-        stateCounter = bitCounter = message[0] = message[1] = message[2] = message[3] = 0;
-        state = NECIR_STATE_BIT_LEADER;
-      } else { // was a repeat code
-        state = NECIR_STATE_WAITING_FOR_IDLE;
-        if (!NECIR_GetRepeatTimeoutFlag()) { // are repeat codes are still allowed for this command?
-          repeatTimeout = (uint16_t)NUM_SAMPLES_IN_MS(110) + 1; // initialize to 110 - 9.0 - 2.25 - 0.5625 ms (idle time between repeats) + leeway
-          if (--nativeRepeatsNeeded == 0) { // have we seen enough native repeat messages to pass one back to the application? 
-            nativeRepeatsNeeded = NECIR_REPEAT_INTERVAL; // "delay until repeat" has been satisfied, so now we set the repeat interval
-#if (NECIR_TURBO_MODE_AFTER != 0)
-            if (++turboModeCounter == NECIR_TURBO_MODE_AFTER) { // have we repeated enough to activate turbo mode?
-              --turboModeCounter; // ensure that we stay in turbo mode
-              nativeRepeatsNeeded = NECIR_TURBO_REPEAT_INTERVAL; // set the turbo mode repeat interval
-            }
-#endif // NECIR_TURBO_MODE_AFTER
-            state = NECIR_STATE_REPEAT_PROCESS; // keep the maximum execution time of the ISR down by enqueueing the message in a new state
-          }
+  for (uint8_t bit = 1; bit; bit <<= 1)
+    if (NECIR_CHANNEL_MASK & bit) {
+      uint8_t event = NECIR_DecoderStep(d, input & bit);
+      if (event == NECIR_EVENT_MESSAGE || event == NECIR_EVENT_REPEAT) {
+#if (NECIR_COALESCE_REPEATS)
+        if (event != NECIR_EVENT_REPEAT || !NECIR_CoalesceRepeat(d)) // unless it was counted on the newest queue entry
+#endif // NECIR_COALESCE_REPEATS
+        if (NECIR_EnqueueMessageIfNotFull(d, event == NECIR_EVENT_REPEAT)) { // if there is room on the queue, put the decoded message on it, otherwise drop the message
+          NECIR_channelQueue[NECIR_tail] = d - NECIR_decoders;
+          NECIR_EnqueueRepeat(event == NECIR_EVENT_REPEAT);
         }
+        NECIR_DecoderDrop(d); // already enqueued, so skip the COMMIT event
+      }
+#if (NECIR_LOW_POWER || NECIR_EVENTS)
+      else if (event == NECIR_EVENT_IDLE && NECIR_ReleaseHeldKey(d)) { // a held key has to be released before its channel is idle
+#if (NECIR_LOW_POWER)
+        ++idleChannels;
+#endif // NECIR_LOW_POWER
       }
+#endif // NECIR_LOW_POWER || NECIR_EVENTS
+      ++d;
     }
+
+#if (NECIR_LOW_POWER)
+  if (idleChannels == NECIR_CHANNELS) // nothing left to time on any channel, so stop sampling until the next leader arrives
+    NECIR_StopSampling();
+#endif // NECIR_LOW_POWER
+}
+
+#else // NECIR_CHANNEL_MASK
+// This interrupt will get called every NECIR_SAMPLE_CYCLES clock cycles
+ISR(NECIR_TIMER_COMPA_vect)
+{
+#if (NECIR_EVENTS || NECIR_SCHEDULER)
+  ++NECIR_ticks;
+#endif // NECIR_EVENTS || NECIR_SCHEDULER
+#if (NECIR_SCHEDULER)
+  NECIR_ClockStep();
+#endif // NECIR_SCHEDULER
+#if (NECIR_TX)
+  if (NECIR_TransmitStep()) // sending, the receiver would only hear our own signal
+    return;
+#endif // NECIR_TX
+  uint8_t sample = inputState(IR_INPUT, IR_PIN);
+#if (NECIR_CAPTURE)
+  NECIR_CaptureSample(sample);
+#endif // NECIR_CAPTURE
+  uint8_t event = NECIR_DecoderStep(&NECIR_decoder, sample);
+  switch (event) {
+  case NECIR_EVENT_REPEAT:
+#if (NECIR_COALESCE_REPEATS)
+    if (NECIR_CoalesceRepeat(&NECIR_decoder)) { // counted on the newest queue entry, so there is nothing to commit
+      NECIR_DecoderDrop(&NECIR_decoder);
+      break;
+    }
+#endif // NECIR_COALESCE_REPEATS
+    // fall through
+  case NECIR_EVENT_MESSAGE: // At this point 'message' contains the raw bits received
+    if (!NECIR_EnqueueMessageIfNotFull(&NECIR_decoder, event == NECIR_EVENT_REPEAT)) // if there is room on the queue, put the decoded message on it, otherwise drop the message
+      NECIR_DecoderDrop(&NECIR_decoder);
     break;
-  case NECIR_STATE_REPEAT_PROCESS:
-    if (NECIR_EnqueueMessageIfNotFull(message)) // if there is room on the queue, put the decoded message on it, otherwise drop the message
-      state = NECIR_STATE_REPEAT_PROCESS2; // split the enqueue across two states to decrease the maximum running time of the ISR
-    else
-      state = NECIR_STATE_WAITING_FOR_IDLE;
+  case NECIR_EVENT_MESSAGE_COMMIT:
+    NECIR_EnqueueRepeat(false); // if there was room on the queue, clear the repeat flag
     break;
-  case NECIR_STATE_REPEAT_PROCESS2:
-    state = NECIR_STATE_WAITING_FOR_IDLE;
+  case NECIR_EVENT_REPEAT_COMMIT:
     NECIR_EnqueueRepeat(true); // if there was room on the queue, set the repeat flag
     break;
-  case NECIR_STATE_BIT_LEADER: // IR was low, needs to be low for 562.5us
-    if (!sample) { // if low now, make sure it hasn't been low for too long
-      if (++stateCounter > (uint8_t)NUM_SAMPLES_IN_MS(0.5625) + 1)
-        state = NECIR_STATE_WAITING_FOR_IDLE; // low for too long, switch to wait for idle state
-    } else { // if high now, make sure that it was low for long enough
-      if (stateCounter < (uint8_t)NUM_SAMPLES_IN_MS(0.5625) - 2)
-        state = NECIR_STATE_IDLE; // was not low for long enough, switch to idle state
-      else  { // was low for 562.5us, switch to bit pause state
-        stateCounter = 0;
-        messageBit = pgm_read_byte(&NECIR_oneLeftShiftedBy[bitCounter % 8]); // pre-calculate the value we might need in the next state to make it faster
-        state = NECIR_STATE_BIT_PAUSE;
-      }
+#if (NECIR_LOW_POWER || NECIR_EVENTS)
+  case NECIR_EVENT_IDLE: // the repeat timeout has expired
+    if (!NECIR_ReleaseHeldKey(&NECIR_decoder)) // the queue is full, try again on the next sample
+      break;
+#if (NECIR_LOW_POWER)
+    NECIR_StopSampling(); // nothing left to time, so stop sampling until the next leader arrives
+#endif // NECIR_LOW_POWER
+    break;
+#endif // NECIR_LOW_POWER || NECIR_EVENTS
+  }
+}
+#endif // NECIR_CHANNEL_MASK
+
+#else // NECIR_DECODE_MODE
+
+// This interrupt gets called on every edge of the IR signal. Since edges
+// arrive at least 562.5us apart, a message can be enqueued right away rather
+// than being split across extra states like the sampled decoder does.
+// As in necir_core.h, the lower bound of a short pulse can come out as zero.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wtype-limits"
+ISR(NECIR_PCINT_vect)
+{
+  uint8_t sample = inputState(IR_INPUT, IR_PIN);
+  if (sample == lastSample) // another pin on the same port changed, nothing to do
+    return;
+  lastSample = sample;
+
+  uint16_t now = NECIR_Timestamp();
+  uint16_t duration = now - lastEdge; // how long the IR signal stayed at its previous level
+  lastEdge = now;
+
+  switch (NECIR_decoder.state) {
+  case NECIR_STATE_WAITING_FOR_IDLE: // IR was low, now high
+    NECIR_decoder.state = NECIR_STATE_IDLE;
+    break;
+  case NECIR_STATE_IDLE: // IR was high, now low, so this could be the start of a leader
+    if (!(NECIR_TIMSK & (1 << NECIR_TOIE))) { // the overflow interrupt was stopped while idle, so restart the time base
+      NECIR_TIFR = (1 << NECIR_TOV); // discard any stale overflow
+      NECIR_TIMSK |= (1 << NECIR_TOIE);
+      lastEdge = NECIR_Timestamp();
+#if (NECIR_LOW_POWER)
+      if (poweredDown) // the edge happened while the oscillator was still starting up
+        lastEdge -= NECIR_WAKEUP_TICKS;
+#endif // NECIR_LOW_POWER
     }
+    NECIR_decoder.state = NECIR_STATE_LEADER;
+    break;
+  case NECIR_STATE_LEADER: // IR was low, needed to be low for 9ms
+    if (duration < NECIR_EDGE_MIN(NECIR_NEC_LEADER) || duration > NECIR_EDGE_MAX(NECIR_NEC_LEADER)) {
+      NECIR_STATS_COUNT(&NECIR_decoder, leaderErrors);
+      NECIR_decoder.state = NECIR_STATE_IDLE; // was not low for the right amount of time, switch to idle state
+    } else
+      NECIR_decoder.state = NECIR_STATE_PAUSE;
     break;
-  case NECIR_STATE_BIT_PAUSE: // IR was high, needs to be high for either 562.5us (0-bit) or 1.6875ms (1-bit)
-    if (sample) { // if high now, make sure it hasn't been high for too long
-      if (++stateCounter > (uint8_t)NUM_SAMPLES_IN_MS(1.6875) + 1)
-        state = NECIR_STATE_IDLE; // high for too long, switch to idle state
-    } else { // if low now, make sure that it was high for long enough
-      if (stateCounter < (uint8_t)NUM_SAMPLES_IN_MS(0.5625) - 2) {
-        state = NECIR_STATE_WAITING_FOR_IDLE; // was not high for long enough, switch to wait for idle state
+  case NECIR_STATE_PAUSE: // IR was high, needed to be high for 4.5ms, or 2.25ms for repeat code
+    if (duration < NECIR_EDGE_MIN(NECIR_NEC_REPEAT_PAUSE)) {
+      NECIR_STATS_COUNT(&NECIR_decoder, pauseErrors);
+      NECIR_decoder.state = NECIR_STATE_WAITING_FOR_IDLE; // was not high for long enough, switch to wait for idle state
+    } else if (duration > NECIR_EDGE_MAX(NECIR_NEC_PAUSE)) {
+      NECIR_STATS_COUNT(&NECIR_decoder, pauseErrors);
+      NECIR_decoder.state = NECIR_STATE_LEADER; // was high for too long, so this edge could be the start of a new leader
+    } else if (duration > NECIR_EDGE_MAX(NECIR_NEC_REPEAT_PAUSE)) { // was high for longer than a repeat code, so switch to bit leader state
+      NECIR_DecoderBeginMessage(&NECIR_decoder, NECIR_REPEAT_TIMEOUT);
+      NECIR_decoder.state = NECIR_STATE_BIT_LEADER;
+    } else { // was a repeat code
+      NECIR_decoder.state = NECIR_STATE_WAITING_FOR_IDLE;
+      if (!NECIR_DecoderRepeatCodeReceived(&NECIR_decoder, NECIR_REPEAT_TIMEOUT))
         break;
-      } else if (stateCounter > (uint8_t)NUM_SAMPLES_IN_MS(0.5625) + 1) // was high for longer than a 0-bit, so it's a 1-bit
-        message[bitCounter / 8] |= messageBit; // way faster than "uint32_t message |= ((uint32_t)1 << bitCounter)"
-      if (++bitCounter < 32) { // are there more bits we need to read in?
-        stateCounter = 0;
-        state = NECIR_STATE_BIT_LEADER; // attempt to read in another bit
-      } else
-        state = NECIR_STATE_PROCESS; // keep the maximum execution time of the ISR down by enqueueing the message in a new state
+#if (NECIR_COALESCE_REPEATS)
+      if (NECIR_CoalesceRepeat(&NECIR_decoder))
+        break; // counted on the newest queue entry
+#endif // NECIR_COALESCE_REPEATS
+      if (NECIR_EnqueueMessageIfNotFull(&NECIR_decoder, true))
+        NECIR_EnqueueRepeat(true); // if there was room on the queue, set the repeat flag
     }
     break;
-  case NECIR_STATE_PROCESS: // At this point 'message' contains a 32-bit value representing the raw bits received
-#if (NECIR_TURBO_MODE_AFTER != 0)
-    turboModeCounter = 0;
-#endif // NECIR_TURBO_MODE_AFTER
-    nativeRepeatsNeeded = NECIR_DELAY_UNTIL_REPEAT; // set "delay until repeat" length
-    if (NECIR_EnqueueMessageIfNotFull(message)) // if there is room on the queue, put the decoded message on it, otherwise drop the message
-      state = NECIR_STATE_PROCESS2; // split the enqueue across two states to decrease the maximum running time of the ISR
-    else
-      state = NECIR_STATE_WAITING_FOR_IDLE;
+  case NECIR_STATE_BIT_LEADER: // IR was low, needed to be low for 562.5us
+    if (duration < NECIR_EDGE_MIN(NECIR_NEC_BIT) || duration > NECIR_EDGE_MAX(NECIR_NEC_BIT)) {
+      NECIR_STATS_COUNT(&NECIR_decoder, bitBurstErrors);
+      NECIR_decoder.state = NECIR_STATE_IDLE; // was not low for the right amount of time, switch to idle state
+    } else
+      NECIR_decoder.state = NECIR_STATE_BIT_PAUSE;
     break;
-  case NECIR_STATE_PROCESS2:
-    state = NECIR_STATE_WAITING_FOR_IDLE;
-    NECIR_EnqueueRepeat(false); // if there was room on the queue, clear the repeat flag
+  case NECIR_STATE_BIT_PAUSE: // IR was high, needed to be high for either 562.5us (0-bit) or 1.6875ms (1-bit)
+    if (duration < NECIR_EDGE_MIN(NECIR_NEC_BIT)) {
+      NECIR_STATS_COUNT(&NECIR_decoder, bitSpaceErrors);
+      NECIR_decoder.state = NECIR_STATE_WAITING_FOR_IDLE; // was not high for long enough, switch to wait for idle state
+      break;
+    } else if (duration > NECIR_EDGE_MAX(NECIR_NEC_ONE_PAUSE)) {
+      NECIR_STATS_COUNT(&NECIR_decoder, bitSpaceErrors);
+      NECIR_decoder.state = NECIR_STATE_LEADER; // was high for too long, so this edge could be the start of a new leader
+      break;
+    } else if (duration > NECIR_EDGE_MAX(NECIR_NEC_BIT)) // was high for longer than a 0-bit, so it's a 1-bit
+      NECIR_decoder.message[NECIR_decoder.bitCounter / 8] |= pgm_read_byte(&NECIR_oneLeftShiftedBy[NECIR_decoder.bitCounter % 8]);
+    if (++NECIR_decoder.bitCounter < 32) { // are there more bits we need to read in?
+      NECIR_decoder.state = NECIR_STATE_BIT_LEADER;
+#ifdef NECIR_ADDRESS_FILTER
+      if (NECIR_decoder.bitCounter == NECIR_ADDRESS_BITS && !NECIR_DecoderAddressAllowed(&NECIR_decoder)) // the address is complete, is the frame for us?
+        NECIR_DecoderRejectAddress(&NECIR_decoder);
+#endif // NECIR_ADDRESS_FILTER
+    } else { // At this point 'message' contains a 32-bit value representing the raw bits received
+      NECIR_decoder.state = NECIR_STATE_WAITING_FOR_IDLE; // wait for the end of the final 562.5us burst
+      NECIR_DecoderBeginRepeats(&NECIR_decoder);
+      if (NECIR_EnqueueMessageIfNotFull(&NECIR_decoder, false))
+        NECIR_EnqueueRepeat(false); // if there was room on the queue, clear the repeat flag
+    }
+    break;
+  default: // the PROCESS states are only used by the sampled decoder
     break;
   }
 }
+#pragma GCC diagnostic pop
+
+// This interrupt gets called every 256 * NECIR_CTC_PRESCALE clock cycles, but
+// only while a message is being received, or while repeat codes are still
+// accepted.
+ISR(NECIR_TIMER_OVF_vect)
+{
+  ++timeHigh;
+
+  if (NECIR_decoder.state == NECIR_STATE_IDLE || NECIR_decoder.state == NECIR_STATE_WAITING_FOR_IDLE) {
+    // If we haven't hit the timeout for when we no longer accept repeats yet, decrement the timeout counter and check
+    if (NECIR_decoder.state == NECIR_STATE_IDLE && !NECIR_GetRepeatTimeoutFlag() && --NECIR_decoder.repeatTimeout == 0)
+      NECIR_SetRepeatTimeoutFlag();
+    if (NECIR_GetRepeatTimeoutFlag()) // nothing left to time, so stop interrupting until the next leader arrives
+      NECIR_TIMSK &= ~(1 << NECIR_TOIE);
+  } else if ((uint16_t)(NECIR_Timestamp() - lastEdge) > NECIR_EDGE_MAX(NECIR_NEC_LEADER)) // no edge for longer than any valid pulse, give up on the message
+    NECIR_decoder.state = lastSample ? NECIR_STATE_IDLE : NECIR_STATE_WAITING_FOR_IDLE;
+}
+
+#endif // NECIR_DECODE_MODE
+
+#if (NECIR_DISPATCH)
+#if (NECIR_USE_EXTENDED_PROTOCOL)
+#define NECIR_READ_MESSAGE(p) pgm_read_dword(p)
+#else // NECIR_USE_EXTENDED_PROTOCOL
+#define NECIR_READ_MESSAGE(p) pgm_read_word(p)
+#endif // NECIR_USE_EXTENDED_PROTOCOL
+
+void NECIR_Dispatch(const necir_dispatch_t *table, uint8_t length, necir_handler_t unknown)
+{
+  while (!NECIR_QueueEmpty()) {
+    necir_message_t message;
+    necir_repeat_t isRepeat;
+#if (NECIR_EVENTS)
+    uint8_t key;
+    necir_tick_t ticks;
+    NECIR_DequeueWithEvent(&message, &isRepeat, &key, &ticks);
+    if (key == NECIR_KEY_RELEASE)
+      continue;
+#else // NECIR_EVENTS
+    NECIR_Dequeue(&message, &isRepeat);
+#endif // NECIR_EVENTS
+
+    // Binary search, so a table of n keys takes at most log2(n) + 1 compares
+    necir_handler_t handler = unknown;
+    uint8_t low = 0;
+    uint8_t high = length;
+    while (low < high) {
+      uint8_t middle = low + (high - low) / 2; // (low + high) / 2 could overflow with -mint8
+      necir_message_t keyMessage = NECIR_READ_MESSAGE(&table[middle].message);
+      if (keyMessage < message)
+        low = middle + 1;
+      else if (keyMessage > message)
+        high = middle;
+      else {
+        if (isRepeat && !(pgm_read_byte(&table[middle].flags) & NECIR_DISPATCH_REPEATS))
+          handler = NULL; // the key doesn't repeat
+        else
+          handler = (necir_handler_t)pgm_read_ptr(&table[middle].handler);
+        break;
+      }
+    }
+    if (handler)
+      handler(message, isRepeat);
+  }
+}
+
+bool NECIR_DispatchTableSorted(const necir_dispatch_t *table, uint8_t length)
+{
+  for (uint8_t i = 1; i < length; ++i)
+    if (NECIR_READ_MESSAGE(&table[i - 1].message) >= NECIR_READ_MESSAGE(&table[i].message))
+      return false;
+  return true;
+}
+#endif // NECIR_DISPATCH
+
+#if (NECIR_EVENTS || NECIR_SCHEDULER)
+necir_tick_t NECIR_Ticks(void)
+{
+  uint8_t sreg = SREG;
+  cli(); // the interrupt routine must not advance the ticks halfway through the copy
+  necir_tick_t ticks = NECIR_ticks;
+  SREG = sreg;
+  return ticks;
+}
+#endif // NECIR_EVENTS || NECIR_SCHEDULER
+
+#if (NECIR_SCHEDULER)
+uint32_t NECIR_Millis(void)
+{
+  uint8_t sreg = SREG;
+  cli(); // the interrupt routine must not advance the milliseconds halfway through the copy
+  uint32_t millis = NECIR_millis;
+  SREG = sreg;
+  return millis;
+}
+
+void NECIR_RunTasks(const necir_task_t *table, uint8_t length)
+{
+  if (!NECIR_taskPending)
+    return;
+  NECIR_taskPending = false;
+  if (length > NECIR_SCHEDULER)
+    length = NECIR_SCHEDULER;
+
+  // Due times are compared by subtracting, so they work across the wrap around of the low 16 bits
+  uint16_t now = (uint16_t)NECIR_Millis();
+  uint16_t next = now + INT16_MAX; // later than any task can be due
+  for (uint8_t i = 0; i < length; ++i) {
+    if ((int16_t)(now - NECIR_taskDues[i]) >= 0) {
+      uint16_t period = pgm_read_word(&table[i].period);
+      NECIR_taskDues[i] += period;
+      if ((int16_t)(now - NECIR_taskDues[i]) >= 0) // more than a whole period late, so skip the runs that were missed
+        NECIR_taskDues[i] = now + period;
+      ((necir_task_function_t)pgm_read_ptr(&table[i].function))();
+    }
+    if ((int16_t)(NECIR_taskDues[i] - now) < (int16_t)(next - now))
+      next = NECIR_taskDues[i];
+  }
+
+  uint8_t sreg = SREG;
+  cli(); // the interrupt routine must not pass the new due time before we check it
+  NECIR_taskDue = next;
+  if ((int16_t)((uint16_t)NECIR_millis - next) >= 0) // already due, the tasks took that long
+    NECIR_taskPending = true;
+  SREG = sreg;
+}
+#endif // NECIR_SCHEDULER
+
+#if (NECIR_STATS)
+#if (NECIR_CHANNEL_MASK)
+void NECIR_GetChannelStats(uint8_t channel, necir_stats_t *stats)
+{
+  uint8_t sreg = SREG;
+  cli(); // the interrupt routine must not update the counters halfway through the copy
+  *stats = NECIR_decoders[channel].stats;
+  SREG = sreg;
+}
+#else // NECIR_CHANNEL_MASK
+void NECIR_GetStats(necir_stats_t *stats)
+{
+  uint8_t sreg = SREG;
+  cli(); // the interrupt routine must not update the counters halfway through the copy
+  *stats = NECIR_decoder.stats;
+  SREG = sreg;
+}
+#endif // NECIR_CHANNEL_MASK
+
+void NECIR_ResetStats(void)
+{
+  uint8_t sreg = SREG;
+  cli();
+#if (NECIR_CHANNEL_MASK)
+  for (uint8_t channel = 0; channel < NECIR_CHANNELS; ++channel)
+    NECIR_decoders[channel].stats = (necir_stats_t){ 0 };
+#else // NECIR_CHANNEL_MASK
+  NECIR_decoder.stats = (necir_stats_t){ 0 };
+#endif // NECIR_CHANNEL_MASK
+  SREG = sreg;
+}
+#endif // NECIR_STATS
+
+// Sleeps until the next interrupt. Called with interrupts disabled, so that
+// whatever the caller checked cannot change before we are asleep, and
+// returns with them enabled.
+static inline void NECIR_SleepUntilInterrupt(void) __attribute__(( always_inline ));
+static inline void NECIR_SleepUntilInterrupt(void) {
+#if (NECIR_LOW_POWER)
+#if (NECIR_DECODE_MODE == 0)
+  bool canPowerDown = (NECIR_PCICR & (1 << NECIR_PCIE)); // sampling is stopped, and a pin change will restart it
+#else // NECIR_DECODE_MODE
+  bool canPowerDown = !(NECIR_TIMSK & (1 << NECIR_TOIE)); // the next edge will restart the time base
+#endif // NECIR_DECODE_MODE
+  set_sleep_mode(canPowerDown ? SLEEP_MODE_PWR_DOWN : SLEEP_MODE_IDLE);
+  poweredDown = canPowerDown;
+#else // NECIR_LOW_POWER
+  set_sleep_mode(SLEEP_MODE_IDLE); // the decoder timer must keep running
+#endif // NECIR_LOW_POWER
+  sleep_enable();
+  sei();
+  sleep_cpu(); // sei() always executes the next instruction first, so a wake-up cannot slip in before we are asleep
+  sleep_disable();
+#if (NECIR_LOW_POWER)
+  poweredDown = false;
+#endif // NECIR_LOW_POWER
+}
+
+// Whether NECIR_WaitMessage() has something to return for
+static inline bool NECIR_WaitOver(void) __attribute__(( always_inline ));
+static inline bool NECIR_WaitOver(void) {
+#if (NECIR_SCHEDULER)
+  return !NECIR_QueueEmpty() || NECIR_taskPending;
+#else // NECIR_SCHEDULER
+  return !NECIR_QueueEmpty();
+#endif // NECIR_SCHEDULER
+}
+
+#if (NECIR_LOW_POWER)
+void NECIR_Sleep(void)
+{
+  cli();
+  NECIR_SleepUntilInterrupt();
+}
+#endif // NECIR_LOW_POWER
+
+void NECIR_WaitMessage(void)
+{
+  for (;;) {
+    cli(); // an interrupt between the check and sleep_cpu() would leave us asleep with a message waiting
+    if (NECIR_WaitOver())
+      break;
+    NECIR_SleepUntilInterrupt();
+  }
+  sei();
+}
+
+#if ((NECIR_EVENTS || NECIR_SCHEDULER) && !NECIR_LOW_POWER)
+bool NECIR_WaitMessageTimeout(necir_tick_t ticks)
+{
+  necir_tick_t start = NECIR_Ticks();
+  for (;;) {
+    cli(); // see NECIR_WaitMessage()
+    if (NECIR_WaitOver() || (necir_tick_t)(NECIR_ticks - start) >= ticks)
+      break;
+    NECIR_SleepUntilInterrupt();
+  }
+  sei();
+  return !NECIR_QueueEmpty();
+}
+#endif // NECIR_EVENTS || NECIR_SCHEDULER
+
+#if (NECIR_EVENTS || NECIR_CHANNEL_MASK || NECIR_PROTOCOL_COUNT > 1)
+// Both batch dequeues, 'tags' is NULL for NECIR_DequeueMany()
+static inline uint8_t NECIR_DequeueBatch(necir_message_t *messages, necir_repeat_t *isRepeats, necir_tags_t *tags, uint8_t length) __attribute__(( always_inline ));
+static inline uint8_t NECIR_DequeueBatch(necir_message_t *messages, necir_repeat_t *isRepeats, necir_tags_t *tags, uint8_t length) {
+  uint8_t count = 0;
+  uint8_t sreg = SREG;
+  cli(); // the interrupt routine must not enqueue, or count a repeat on an entry, halfway through the copy
+  while (count < length && !NECIR_QueueEmpty()) {
+    if (tags) {
+#if (NECIR_EVENTS)
+      tags[count].key = NECIR_keyQueue[NECIR_head];
+      tags[count].ticks = NECIR_timestampQueue[NECIR_head];
+#endif // NECIR_EVENTS
+#if (NECIR_CHANNEL_MASK)
+      tags[count].channel = NECIR_channelQueue[NECIR_head];
+#endif // NECIR_CHANNEL_MASK
+#if (NECIR_PROTOCOL_COUNT > 1)
+      tags[count].protocol = NECIR_protocolQueue[NECIR_head];
+#endif // NECIR_PROTOCOL_COUNT
+    }
+#if (NECIR_EVENTS)
+    else if (NECIR_keyQueue[NECIR_head] == NECIR_KEY_RELEASE)
+      break; // left queued, see NECIR_DequeueMany()
+#endif // NECIR_EVENTS
+    NECIR_Dequeue(&messages[count], &isRepeats[count]);
+    ++count;
+  }
+  SREG = sreg;
+  return count;
+}
+
+uint8_t NECIR_DequeueMany(necir_message_t *messages, necir_repeat_t *isRepeats, uint8_t length)
+{
+  return NECIR_DequeueBatch(messages, isRepeats, NULL, length);
+}
+
+uint8_t NECIR_DequeueManyWithTags(necir_message_t *messages, necir_repeat_t *isRepeats, necir_tags_t *tags, uint8_t length)
+{
+  return NECIR_DequeueBatch(messages, isRepeats, tags, length);
+}
+#else // NECIR_EVENTS || NECIR_CHANNEL_MASK || NECIR_PROTOCOL_COUNT
+uint8_t NECIR_DequeueMany(necir_message_t *messages, necir_repeat_t *isRepeats, uint8_t length)
+{
+  uint8_t count = 0;
+  uint8_t sreg = SREG;
+  cli(); // the interrupt routine must not enqueue, or count a repeat on an entry, halfway through the copy
+  while (count < length && !NECIR_QueueEmpty()) {
+    NECIR_Dequeue(&messages[count], &isRepeats[count]);
+    ++count;
+  }
+  SREG = sreg;
+  return count;
+}
+#endif // NECIR_EVENTS || NECIR_CHANNEL_MASK || NECIR_PROTOCOL_COUNT
@@ -50,6 +50,10 @@
 
 extern const uint8_t NECIR_oneLeftShiftedBy[8] PROGMEM; // avoids having to bit shift by a variable amount
 
+// For the protocol numbers. necir.c defines the decoder hooks, which use the
+// macros above, before including this file.
+#include "necir_core.h"
+
 #if (NECIR_USE_EXTENDED_PROTOCOL)
 typedef uint32_t necir_message_t;
 #else // NECIR_USE_EXTENDED_PROTOCOL
@@ -61,12 +65,19 @@ typedef uint16_t necir_message_t;
 #endif // NECIR_QUEUE_LENGTH
 extern volatile necir_message_t NECIR_messageQueue[NECIR_QUEUE_LENGTH];
 
+#if (NECIR_COALESCE_REPEATS)
+// The number of repeats in each queue entry, zero for a new message
+typedef uint8_t necir_repeat_t;
+extern volatile uint8_t NECIR_repeatCountQueue[NECIR_QUEUE_LENGTH];
+#else // NECIR_COALESCE_REPEATS
+typedef bool necir_repeat_t;
 #if ((NECIR_QUEUE_LENGTH) % 8 == 0)
 #define NECIR_REPEAT_QUEUE_BYTES ((NECIR_QUEUE_LENGTH) / 8)
 #else // NECIR_QUEUE_LENGTH
 #define NECIR_REPEAT_QUEUE_BYTES ((NECIR_QUEUE_LENGTH) / 8 + 1)
 #endif // NECIR_QUEUE_LENGTH
 extern volatile uint8_t NECIR_repeatFlagQueue[NECIR_REPEAT_QUEUE_BYTES];
+#endif // NECIR_COALESCE_REPEATS
 
 extern uint8_t NECIR_head;
 extern volatile uint8_t NECIR_tail;
@@ -76,11 +87,246 @@ static inline uint8_t NECIR_QueueEmpty(void) {
   return (NECIR_head == NECIR_tail);
 }
 
-static inline void NECIR_Dequeue(necir_message_t *message, bool *isRepeat) __attribute__(( always_inline ));
-static inline void NECIR_Dequeue(necir_message_t *message, bool *isRepeat) {
+// With NECIR_COALESCE_REPEATS, isRepeat is the number of repeats the entry
+// stands for, so it can still be tested as a bool
+static inline void NECIR_Dequeue(necir_message_t *message, necir_repeat_t *isRepeat) __attribute__(( always_inline ));
+static inline void NECIR_Dequeue(necir_message_t *message, necir_repeat_t *isRepeat) {
   *message = NECIR_messageQueue[NECIR_head];
+#if (NECIR_COALESCE_REPEATS)
+  *isRepeat = NECIR_repeatCountQueue[NECIR_head];
+#else // NECIR_COALESCE_REPEATS
   *isRepeat = NECIR_repeatFlagQueue[NECIR_head / 8] & pgm_read_byte(&NECIR_oneLeftShiftedBy[NECIR_head % 8]);
+#endif // NECIR_COALESCE_REPEATS
   NECIR_head = (NECIR_head + 1) % NELEMS(NECIR_messageQueue);
 }
 
+#if (NECIR_CHANNEL_MASK)
+extern volatile uint8_t NECIR_channelQueue[NECIR_QUEUE_LENGTH];
+
+// Same as NECIR_Dequeue(), but also returns which channel received the
+// message: 0 for the lowest pin set in NECIR_CHANNEL_MASK, 1 for the next, etc.
+static inline void NECIR_DequeueWithChannel(necir_message_t *message, necir_repeat_t *isRepeat, uint8_t *channel) __attribute__(( always_inline ));
+static inline void NECIR_DequeueWithChannel(necir_message_t *message, necir_repeat_t *isRepeat, uint8_t *channel) {
+  *channel = NECIR_channelQueue[NECIR_head];
+  NECIR_Dequeue(message, isRepeat);
+}
+#endif // NECIR_CHANNEL_MASK
+
+#if (NECIR_EVENTS || NECIR_SCHEDULER)
+// Sampling interrupts, NECIR_SAMPLE_CYCLES clock cycles each
+typedef uint16_t necir_tick_t;
+#endif // NECIR_EVENTS || NECIR_SCHEDULER
+
+#if (NECIR_EVENTS)
+// What happened to the key of each queue entry
+enum {
+  NECIR_KEY_PRESS,
+  NECIR_KEY_REPEAT,
+  NECIR_KEY_RELEASE,
+};
+
+extern volatile uint8_t NECIR_keyQueue[NECIR_QUEUE_LENGTH];
+extern volatile necir_tick_t NECIR_timestampQueue[NECIR_QUEUE_LENGTH];
+
+// Same as NECIR_Dequeue(), but also returns NECIR_KEY_PRESS, NECIR_KEY_REPEAT
+// or NECIR_KEY_RELEASE, and the NECIR_Ticks() value when it happened. A
+// release has the message of the key that was released, and isRepeat false.
+// With NECIR_COALESCE_REPEATS, the timestamp of a repeat entry is that of the
+// last repeat counted on it.
+static inline void NECIR_DequeueWithEvent(necir_message_t *message, necir_repeat_t *isRepeat, uint8_t *key, necir_tick_t *ticks) __attribute__(( always_inline ));
+static inline void NECIR_DequeueWithEvent(necir_message_t *message, necir_repeat_t *isRepeat, uint8_t *key, necir_tick_t *ticks) {
+  *key = NECIR_keyQueue[NECIR_head];
+  *ticks = NECIR_timestampQueue[NECIR_head];
+  NECIR_Dequeue(message, isRepeat);
+}
+#endif // NECIR_EVENTS
+
+#if (NECIR_PROTOCOL_COUNT > 1)
+extern volatile uint8_t NECIR_protocolQueue[NECIR_QUEUE_LENGTH];
+
+// Same as NECIR_Dequeue(), but also returns which protocol the message was
+// received in: NECIR_NEC, NECIR_SAMSUNG32, NECIR_SIRC or NECIR_RC5
+static inline void NECIR_DequeueWithProtocol(necir_message_t *message, necir_repeat_t *isRepeat, uint8_t *protocol) __attribute__(( always_inline ));
+static inline void NECIR_DequeueWithProtocol(necir_message_t *message, necir_repeat_t *isRepeat, uint8_t *protocol) {
+  *protocol = NECIR_protocolQueue[NECIR_head];
+  NECIR_Dequeue(message, isRepeat);
+}
+#endif // NECIR_PROTOCOL_COUNT
+
+#if (NECIR_TX)
+#if ((NECIR_TX_QUEUE_LENGTH <= 0) || NECIR_TX_QUEUE_LENGTH > 256)
+#error "NECIR_TX_QUEUE_LENGTH must be between 1 and 256, powers of two preferred"
+#endif // NECIR_TX_QUEUE_LENGTH
+extern volatile necir_message_t NECIR_sendQueue[NECIR_TX_QUEUE_LENGTH];
+extern volatile uint8_t NECIR_sendRepeatsQueue[NECIR_TX_QUEUE_LENGTH];
+extern volatile uint8_t NECIR_sendHead;
+extern uint8_t NECIR_sendTail;
+
+static inline uint8_t NECIR_SendQueueFull(void) __attribute__(( always_inline ));
+static inline uint8_t NECIR_SendQueueFull(void) {
+  return (NECIR_sendHead == (NECIR_sendTail + 1) % NELEMS(NECIR_sendQueue));
+}
+
+// Queues a message to be sent, followed by 'repeats' native repeat codes,
+// as if its key was held for that long. Returns false, and sends nothing, if
+// the send queue is full.
+static inline bool NECIR_Send(necir_message_t message, uint8_t repeats) __attribute__(( always_inline ));
+static inline bool NECIR_Send(necir_message_t message, uint8_t repeats) {
+  if (NECIR_SendQueueFull())
+    return false;
+  NECIR_sendQueue[NECIR_sendTail] = message;
+  NECIR_sendRepeatsQueue[NECIR_sendTail] = repeats;
+  NECIR_sendTail = (NECIR_sendTail + 1) % NELEMS(NECIR_sendQueue);
+  return true;
+}
+#endif // NECIR_TX
+
+#if (NECIR_CAPTURE)
+#if ((NECIR_CAPTURE_LENGTH < 2) || NECIR_CAPTURE_LENGTH > 256)
+#error "NECIR_CAPTURE_LENGTH must be between 2 and 256, powers of two preferred"
+#endif // NECIR_CAPTURE_LENGTH
+// Level bit and more-bytes bit of the first byte of a captured run, see necir.mk
+#define NECIR_CAPTURE_SPACE 0x80
+#define NECIR_CAPTURE_MORE 0x40
+
+extern volatile uint8_t NECIR_captureBuffer[NECIR_CAPTURE_LENGTH];
+extern uint8_t NECIR_captureHead;
+extern volatile uint8_t NECIR_captureTail;
+extern volatile bool NECIR_captureOverflow; // set when a run was dropped, clear it yourself
+
+// Points *data at the oldest captured bytes, and returns how many of them can
+// be read there in one piece, or 0 if there are none. When the captured bytes
+// wrap around the end of the buffer, the rest is returned by the next call,
+// after NECIR_CaptureConsume(). The interrupt routine doesn't touch these
+// bytes until they are consumed.
+static inline uint8_t NECIR_CaptureSpan(const uint8_t **data) __attribute__(( always_inline ));
+static inline uint8_t NECIR_CaptureSpan(const uint8_t **data) {
+  uint8_t tail = NECIR_captureTail;
+  *data = (const uint8_t*)&NECIR_captureBuffer[NECIR_captureHead];
+  return (tail >= NECIR_captureHead ? tail : NELEMS(NECIR_captureBuffer)) - NECIR_captureHead;
+}
+
+// Frees 'length' bytes returned by NECIR_CaptureSpan() for capturing
+static inline void NECIR_CaptureConsume(uint8_t length) __attribute__(( always_inline ));
+static inline void NECIR_CaptureConsume(uint8_t length) {
+  NECIR_captureHead = (NECIR_captureHead + length) % NELEMS(NECIR_captureBuffer);
+}
+#endif // NECIR_CAPTURE
+
 void NECIR_Init(void);
+
+#if (NECIR_DISPATCH)
+typedef void (*necir_handler_t)(necir_message_t message, necir_repeat_t isRepeat);
+
+// Flags of a key in the dispatch table
+#define NECIR_DISPATCH_REPEATS 1 // also call the handler for repeats of the key
+
+// An entry of a dispatch table, which is kept in PROGMEM and sorted by message
+typedef struct {
+  necir_message_t message;
+  uint8_t flags;
+  necir_handler_t handler;
+} necir_dispatch_t;
+
+// Dequeues every waiting message and calls the handler of its key in 'table',
+// which has 'length' entries. Messages that aren't in the table are passed to
+// 'unknown', unless it is NULL.
+void NECIR_Dispatch(const necir_dispatch_t *table, uint8_t length, necir_handler_t unknown);
+
+// Returns whether the messages in 'table' are in strictly ascending order,
+// as NECIR_Dispatch() needs. Call it once at startup, since a table out of
+// order makes keys go missing without any other sign.
+bool NECIR_DispatchTableSorted(const necir_dispatch_t *table, uint8_t length);
+#endif // NECIR_DISPATCH
+
+#if (NECIR_EVENTS || NECIR_SCHEDULER)
+// Returns the number of sampling interrupts so far, as used for the event
+// timestamps. Wraps around, so only compare them by subtracting.
+necir_tick_t NECIR_Ticks(void);
+#endif // NECIR_EVENTS || NECIR_SCHEDULER
+
+#if (NECIR_SCHEDULER)
+// Returns the milliseconds since NECIR_Init(). Wraps around after 49 days.
+uint32_t NECIR_Millis(void);
+
+typedef void (*necir_task_function_t)(void);
+
+// An entry of a task table, which is kept in PROGMEM
+typedef struct {
+  uint16_t period; // in milliseconds, up to 32767
+  necir_task_function_t function;
+} necir_task_t;
+
+// Runs the tasks in 'table' that are due, call it from the main loop. Only
+// the first NECIR_SCHEDULER of its 'length' entries are run.
+void NECIR_RunTasks(const necir_task_t *table, uint8_t length);
+#endif // NECIR_SCHEDULER
+
+#if (NECIR_STATS)
+// Copies the decoder statistics (see necir_stats_t in necir_core.h) with
+// interrupts disabled, so the counters are consistent with each other
+#if (NECIR_CHANNEL_MASK)
+void NECIR_GetChannelStats(uint8_t channel, necir_stats_t *stats);
+#else // NECIR_CHANNEL_MASK
+void NECIR_GetStats(necir_stats_t *stats);
+#endif // NECIR_CHANNEL_MASK
+// Clears the statistics of every channel
+void NECIR_ResetStats(void);
+#endif // NECIR_STATS
+
+#if (NECIR_LOW_POWER)
+// Puts the CPU to sleep until the next interrupt. Power-down is used while
+// the decoder has nothing left to time, otherwise idle sleep is used so the
+// decoder timer keeps running.
+void NECIR_Sleep(void);
+#endif // NECIR_LOW_POWER
+
+// Returns once a message is waiting on the queue, or with NECIR_SCHEDULER
+// once a task is due, sleeping in between. The CPU is put in idle sleep, or
+// with NECIR_LOW_POWER in the same sleep mode NECIR_Sleep() would pick, and
+// every interrupt that wakes it checks the queue again, so call this with
+// interrupts enabled.
+//
+// Idle sleep keeps the clocks running and adds 4 cycles of wake-up to the
+// interrupt response. The wake-up latency and sleep current have not been
+// measured on either the ATtiny85 or the ATmega328P.
+void NECIR_WaitMessage(void);
+
+#if ((NECIR_EVENTS || NECIR_SCHEDULER) && !NECIR_LOW_POWER)
+// Same as NECIR_WaitMessage(), but gives up after 'ticks' sampling
+// interrupts, see NECIR_MS_TO_SAMPLES(). Returns whether a message is
+// waiting, which it may not be with NECIR_SCHEDULER when a task is due first.
+bool NECIR_WaitMessageTimeout(necir_tick_t ticks);
+#endif // NECIR_EVENTS || NECIR_SCHEDULER
+
+// Dequeues up to 'length' messages into 'messages' and 'isRepeats', oldest
+// first, and returns how many there were. Interrupts are disabled for the
+// whole copy, about 30 cycles per message, so the messages are one
+// consistent snapshot of the queue, but keep 'length' to what you need.
+//
+// Warning: With NECIR_EVENTS, the copy stops before a NECIR_KEY_RELEASE
+// entry, which stays queued, since it would look like a second press. So 0
+// with the queue not empty means a release is next: dequeue it with
+// NECIR_DequeueWithEvent(), or use NECIR_DequeueManyWithTags() instead. The
+// channel and protocol of each message are not returned either.
+uint8_t NECIR_DequeueMany(necir_message_t *messages, necir_repeat_t *isRepeats, uint8_t length);
+
+#if (NECIR_EVENTS || NECIR_CHANNEL_MASK || NECIR_PROTOCOL_COUNT > 1)
+// What NECIR_Dequeue() doesn't return about a queue entry
+typedef struct {
+#if (NECIR_EVENTS)
+  uint8_t key; // NECIR_KEY_PRESS, NECIR_KEY_REPEAT or NECIR_KEY_RELEASE
+  necir_tick_t ticks; // see NECIR_DequeueWithEvent()
+#endif // NECIR_EVENTS
+#if (NECIR_CHANNEL_MASK)
+  uint8_t channel; // see NECIR_DequeueWithChannel()
+#endif // NECIR_CHANNEL_MASK
+#if (NECIR_PROTOCOL_COUNT > 1)
+  uint8_t protocol; // see NECIR_DequeueWithProtocol()
+#endif // NECIR_PROTOCOL_COUNT
+} necir_tags_t;
+
+// Same as NECIR_DequeueMany(), but returns every entry, releases included,
+// along with its tags in 'tags'
+uint8_t NECIR_DequeueManyWithTags(necir_message_t *messages, necir_repeat_t *isRepeats, necir_tags_t *tags, uint8_t length);
+#endif // NECIR_EVENTS || NECIR_CHANNEL_MASK || NECIR_PROTOCOL_COUNT
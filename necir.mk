@@ -1,12 +1,69 @@
 # ---------- Begin NECIR Configuration Section ----------
 
 # Defines which 8-bit Timer is used to generate the interrupt that
-# fires every ((uint8_t)(F_CPU/1000000))*256 clock cycles. Useful if
-# you are already using a timer for something else.
+# fires every NECIR_SAMPLE_CYCLES clock cycles. Useful if you are already
+# using a timer for something else.
 #  0 = 8-bit Timer/Counter0
 #  2 = 8-bit Timer/Counter2
 NECIR_ISR_CTC_TIMER = 0
 
+# How many times the IR signal is sampled per NEC bit (562.5us). The
+# prescaler and OCR value of the timer above are worked out from this and
+# F_CPU at compile time (see necir_timing.h), using the smallest prescaler
+# that fits, so the sample period is within 1.6% of 562.5us divided by this
+# on any clock, and every pulse length threshold is an integer constant
+# computed from the actual period. The interrupt rate is about 1778 times
+# this per second, whatever the clock.
+#
+# 2 samples per bit is the lowest interrupt rate that decodes reliably, and
+# what the decoder was tuned for. More samples measure pulses more finely,
+# e.g. for NECIR_STATS histograms, but the acceptance windows stay the same
+# length in time: a bit below and half a bit above the nominal length.
+#
+# Note: NECIR_ASM_ISR requires 2. Pulse lengths up to the 9ms NEC leader
+#       must fit an 8-bit counter, which is checked at compile time.
+#
+# 2-15 = Samples per NEC bit
+NECIR_SAMPLES_PER_BIT = 2
+
+# Defines how the IR signal is decoded.
+#  0 = Sample IR_PIN from the periodic timer interrupt described above. The
+#      interrupt fires NECIR_SAMPLE_CYCLES clock cycles apart (about 3,500
+#      times per second with 2 samples per bit), whether or not anything is
+#      being received.
+#  1 = Decode from the edges of the IR signal. A pin change interrupt on
+#      IR_PIN timestamps each edge with the timer selected above, which runs
+#      freely with the same prescaler, and pulse widths are classified with
+#      the same windows that mode 0 uses. The timer overflow interrupt is only
+#      enabled while a message is being received or while repeat codes are
+#      still accepted, so the interrupt load grows with IR traffic instead.
+#
+# Note: Mode 1 takes over the pin change interrupt vector for the port of
+#       IR_PIN (PCINT0_vect on the ATtiny85), so your application must not
+#       define that vector itself.
+NECIR_DECODE_MODE = 0
+
+# Low-power idle. Battery powered boards spend nearly all of their time
+# waiting for a message, so once the repeat timeout has expired and the IR
+# signal is idle, the decoder stops interrupting altogether:
+#  - In NECIR_DECODE_MODE 0 the sampling timer is stopped, and a pin change
+#    interrupt on IR_PIN restarts it in the leader state on the next falling
+#    edge.
+#  - In NECIR_DECODE_MODE 1 the timer overflow interrupt is already stopped
+#    while idle, so only NECIR_Sleep() below is added.
+# NECIR_Sleep() enters power-down when that is safe, and idle sleep otherwise.
+#
+# 0 = Disabled
+# 1 = Enabled (also takes over the pin change interrupt vector of IR_PIN)
+NECIR_LOW_POWER = 0
+
+# Oscillator start-up time after power-down, in clock cycles, as selected by
+# the SUT/CKSEL fuses. It is added to the length of a leader whose first edge
+# woke the CPU from power-down. The ATtiny85 PLL clock fuses in the Makefile
+# (lfuse 0xe1) select 1K CK; crystal oscillators usually need 16K CK, and the
+# internal RC oscillator 6 CK.
+NECIR_WAKEUP_CYCLES = 1024
+
 # Determines whether or not GPIOR0 is used to store flags. This special-purpose
 # register is designed to store bit flags, as it can set, clear or test a
 # single bit in only 2 clock cycles.
@@ -18,8 +75,41 @@ NECIR_USE_GPIOR0 = 1
 # GPIOR0 flag bits used
 ifeq ($(NECIR_USE_GPIOR0), 1)
 NECIR_FLAG_REPEAT_TIMEOUT = 3
+NECIR_FLAG_ASM_IDLE = 4
 endif
 
+# Replaces the sampling interrupt of NECIR_DECODE_MODE 0 with the
+# hand-written assembly version in necir_isr.S. It keeps the decoder state
+# and sample counter in GPIOR1 and GPIOR2, and only saves the registers each
+# state actually uses, so an IDLE tick with nothing to do takes 10 cycles
+# instead of a full C prologue and epilogue.
+#
+# Worst case cycles per state, hand counted from necir_isr.S, from the first
+# instruction of the routine up to and including the reti:
+#
+#   IDLE, repeats expired    10     BIT_LEADER          36
+#   IDLE, IR high            38     BIT_PAUSE           62
+#   IDLE, IR low             48     PROCESS             89 (92 turbo)
+#   WAITING_FOR_IDLE         34     PROCESS2            86
+#   LEADER                   42     REPEAT_PROCESS      92
+#   PAUSE                    65     REPEAT_PROCESS2     87
+#                     (78 turbo)
+#
+# The standard protocol's inverse check adds 4 cycles, and a queue length
+# that is not a power of two adds 2 cycles to every state that enqueues.
+# "make bench" counts from the vector table slot, so its maximums should
+# come out 2 (ATtiny85, rjmp) or 3 (ATmega328P, jmp) cycles higher. The
+# bench has not been run against these counts yet, and the C routine has
+# no hand count to compare with.
+#
+# Note: Requires NECIR_DECODE_MODE = 0, NECIR_LOW_POWER = 0 and
+#       NECIR_USE_GPIOR0 = 1. Your application must not use GPIOR1, GPIOR2
+#       or the NECIR_FLAG_ASM_IDLE bit of GPIOR0.
+#
+# 0 = Use the C interrupt routine in necir.c
+# 1 = Use the assembly interrupt routine in necir_isr.S
+NECIR_ASM_ISR = 0
+
 # NEC IR messages are decoded in real-time by the interrupt routine,
 # and are placed into a queue where the main() routine can fetch them.
 # NECIR_QUEUE_LENGTH defines the length of this queue, and thus the
@@ -32,6 +122,177 @@ endif
 #       are strongly preferred.
 NECIR_QUEUE_LENGTH = 8
 
+# Repeat coalescing. While a button is held, every repeat normally takes a
+# queue entry of its own, so a main() that is busy for a while can find the
+# queue full of repeats and miss the next key press. With coalescing, a
+# repeat of the same message is counted on the newest unread entry instead,
+# and NECIR_Dequeue() returns that count (saturating at 255) rather than a
+# repeat flag: 0 for a new message, 1 or more for repeats. A held button
+# then takes at most two entries besides its first message.
+#
+# Each entry needs a count byte instead of a repeat flag bit, but the queue
+# can be made shorter for the same number of distinct key presses, e.g.
+# NECIR_QUEUE_LENGTH = 4 with coalescing uses 20 bytes of RAM with the
+# extended protocol, where 8 without it uses 33.
+#
+# Note: Not supported by NECIR_ASM_ISR.
+#
+# 0 = Queue every repeat
+# 1 = Coalesce repeats
+NECIR_COALESCE_REPEATS = 0
+
+# Decoder statistics, for finding out why a remote or a receiver is not
+# working well. Every decoder counts the messages and repeats it queued or
+# dropped because the queue was full, the messages that failed the inverse
+# bit check, the frames rejected by NECIR_ADDRESS_FILTER, the pulses rejected
+# at each stage of a frame, and the most entries ever waiting on the queue.
+# With histograms, it also counts how many samples each leader, pause,
+# burst and space within a frame lasted (as the decoder's stateCounter, so
+# one less than the actual count), which shows how far the remote's timing
+# is off. All counters saturate at 65535.
+#
+# Read them with NECIR_GetStats() (NECIR_GetChannelStats() with
+# NECIR_CHANNEL_MASK) and clear them with NECIR_ResetStats(). Both disable
+# interrupts while they copy, for about 2 cycles per byte.
+#
+# The counters take 21 bytes of RAM per channel, the histograms another
+# 144 bytes or so per channel with NEC. When disabled, none of this is
+# compiled in and the interrupt routine is unchanged.
+#
+# Note: Not supported by NECIR_ASM_ISR. With NECIR_DECODE_MODE = 1 only the
+#       counters are kept.
+#
+# 0 = Disabled
+# 1 = Counters
+# 2 = Counters and histograms
+NECIR_STATS = 0
+
+# Key events. Every queued message is also tagged with what happened to the
+# key, NECIR_KEY_PRESS, NECIR_KEY_REPEAT or NECIR_KEY_RELEASE, and with the
+# NECIR_Ticks() value of the sample that completed it, see
+# NECIR_DequeueWithEvent(). A release is queued for the last key pressed once
+# its repeat timeout (about 110ms after the last repeat code) expires, so an
+# application can tell how long a key was held without timing it itself. A
+# press of another key before then ends the hold without a release.
+#
+# Ticks are sampling interrupts, NECIR_SAMPLE_CYCLES clock cycles each
+# (about 281us with 2 samples per bit), and wrap around after 65536. With
+# NECIR_LOW_POWER the timer stops while nothing is received, so timestamps
+# are only comparable within one press, from its press to its release.
+#
+# Costs 3 bytes of RAM per queue entry, and about 10 cycles per interrupt
+# to count the ticks. NECIR_Dequeue() still works, but can't tell a release
+# from a press.
+#
+# Note: Requires NECIR_DECODE_MODE = 0 and NECIR_ASM_ISR = 0.
+#
+# 0 = Disabled
+# 1 = Queue press, repeat and release events with timestamps
+NECIR_EVENTS = 0
+
+# Key dispatch. Instead of comparing each dequeued message against every
+# key code in turn, the application declares a PROGMEM table of
+# necir_dispatch_t entries, {message, flags, handler}, sorted by message, and
+# calls NECIR_Dispatch() from its main loop. That drains the queue, finds
+# each message with a binary search, and calls its handler, so 40 keys take
+# at most 6 compares instead of 40. Repeats are only passed to handlers of
+# keys flagged NECIR_DISPATCH_REPEATS, and messages that aren't in the table
+# go to an optional fallback handler. See main.c for an example.
+#
+# The table must be sorted by message in ascending order, since C can't
+# sort it at compile time; an unsorted table makes keys go missing. Check it
+# once at startup with NECIR_DispatchTableSorted(), as main.c does.
+#
+# Note: With NECIR_EVENTS, releases are not dispatched.
+#
+# 0 = Disabled
+# 1 = Provide NECIR_Dispatch()
+NECIR_DISPATCH = 0
+
+# System clock and cooperative scheduler, run off the sampling interrupt so
+# the application doesn't need a timer of its own for them. NECIR_Ticks()
+# returns the sampling interrupts so far, as for NECIR_EVENTS, and
+# NECIR_Millis() the milliseconds since NECIR_Init(), as a 32-bit count that
+# wraps around after 49 days. The interrupt counts milliseconds by adding
+# NECIR_SAMPLE_CYCLES to a fraction, so the clock is as accurate as F_CPU.
+#
+# Tasks are declared in a PROGMEM table of necir_task_t entries, {period in
+# ms, function}, which the main loop passes to NECIR_RunTasks(). Every task
+# runs on the first call, then once per period. The interrupt flags when the
+# earliest task is due, so NECIR_RunTasks() returns after checking one flag
+# the rest of the time. Tasks run from the main loop, so they can take as
+# long as they like, but a task that runs long delays the others; a task
+# that falls more than a whole period behind skips the runs it missed
+# instead of running them back to back. See main.c for an example.
+#
+# Note: Requires NECIR_DECODE_MODE = 0, NECIR_LOW_POWER = 0 and
+#       NECIR_ASM_ISR = 0, since the clock only runs while sampling does.
+#       Periods can be up to 32767ms. Costs 11 bytes of RAM plus 2 per
+#       task, and about 25 cycles per interrupt.
+#
+# 0 = Disabled
+# 1-255 = Clock, and room for this many tasks
+NECIR_SCHEDULER = 0
+
+# NEC transmitter, for using a board as an IR bridge or repeater. NECIR_Send()
+# puts a message on a send queue and returns right away; the sampling
+# interrupt then sends it as marks and spaces timed in samples, followed by
+# the given number of native repeat codes every 108ms. Messages are sent the
+# way they are received: with the standard protocol, the inverse address and
+# command bytes are generated.
+#
+# The 38kHz carrier is generated by Timer1 on its OC1A pin, PB1 on both the
+# ATtiny85 and the ATmega328P, which drives the IR LED (through a transistor,
+# active high). Timer1 can't be used for anything else. While a frame or its
+# repeat codes are being sent, including the gaps between them, the receiver
+# ignores IR_PIN so it doesn't decode its own signal.
+#
+# Marks and spaces are whole samples, so they are as accurate as the sample
+# period: within 0.5% at 16MHz, but about 9% short at 1MHz.
+#
+# Note: Requires NECIR_DECODE_MODE = 0, NECIR_LOW_POWER = 0 and
+#       NECIR_ASM_ISR = 0.
+#
+# NECIR_TX
+# 0 = Receive only
+# 1 = Also send
+#
+# NECIR_TX_QUEUE_LENGTH
+# 1-256 = Number of messages that can wait to be sent, powers of two preferred
+NECIR_TX = 0
+NECIR_TX_QUEUE_LENGTH = 4
+
+# Raw capture ("learning") mode. Besides being decoded, the IR signal is
+# recorded as a sequence of runs: how many samples it stayed low (a mark) or
+# high (a space). This is for remotes that don't decode, to look at their
+# signal or replay it. "necir_decode -c" decodes a capture dump offline.
+#
+# Each run takes 1 byte if shorter than 64 samples (about 18ms), which
+# covers every mark and space within a NEC frame, 2 bytes if shorter than
+# 8192 samples and 3 bytes otherwise, saturating at 65535 samples:
+#
+#   byte 0: bit 7 level (1 = space), bit 6 more bytes follow, bits 5-0 samples
+#   byte 1: bit 7 a third byte follows, bits 6-0 samples >> 6
+#   byte 2: samples >> 13
+#
+# main() reads the ring buffer in place while capture goes on, with
+# NECIR_CaptureSpan() and NECIR_CaptureConsume(). A run that doesn't fit is
+# dropped whole and NECIR_captureOverflow is set, so the buffer always holds
+# whole runs. The run in progress is only written once the level changes.
+# With NECIR_CHANNEL_MASK, the lowest channel is captured.
+#
+# Note: Requires NECIR_DECODE_MODE = 0, NECIR_LOW_POWER = 0 and
+#       NECIR_ASM_ISR = 0. Nothing is captured while NECIR_TX is sending.
+#
+# NECIR_CAPTURE
+# 0 = Disabled
+# 1 = Capture runs
+#
+# NECIR_CAPTURE_LENGTH
+# 2-256 = Size of the ring buffer in bytes, powers of two preferred
+NECIR_CAPTURE = 0
+NECIR_CAPTURE_LENGTH = 64
+
 # The NEC IR standard specifies a 32-bit message, sent LSB-first with
 # the first 8-bits being an address, followed by the 8-bit inverse of
 # that address, followed by an 8-bit command, followed by the 8-bit
@@ -44,6 +305,81 @@ NECIR_QUEUE_LENGTH = 8
 # 1 = Use the extended NEC protocol (Required for Adafruit Mini IR Remote)
 NECIR_USE_EXTENDED_PROTOCOL = 1
 
+# Protocols decoded besides NEC. The decoder tells them apart by the length
+# of their leader, and only the states of the enabled protocols are compiled
+# into the interrupt routine. When more than one protocol is enabled, queued
+# messages are tagged with the protocol that received them, see
+# NECIR_DequeueWithProtocol(). Messages are queued as:
+#
+#   NEC, Samsung32: as described above; Samsung32 sends the address twice
+#                   instead of its inverse, which standard mode validates
+#   SIRC:           address << 8 | command; in extended mode the 8 extended
+#                   bits of a 20-bit frame are added << 16
+#   RC5:            address << 8 | command, command bit 6 being the
+#                   inverted second start bit (RC5X)
+#
+# Samsung32, SIRC and RC5 resend the whole frame while a key is held, so an
+# identical frame within the repeat timeout counts as a native repeat for
+# NECIR_DELAY_UNTIL_REPEAT and the settings below.
+#
+# Note: Anything but NEC alone requires NECIR_DECODE_MODE = 0 and
+#       NECIR_ASM_ISR = 0.
+#
+# 0 = Disabled
+# 1 = Enabled
+NECIR_PROTOCOL_NEC = 1
+NECIR_PROTOCOL_SAMSUNG32 = 0
+NECIR_PROTOCOL_SIRC = 0
+NECIR_PROTOCOL_RC5 = 0
+
+# Clock-drift compensation for NEC remotes whose oscillator is off by more
+# than the fixed windows allow (the 9ms leader only has half a bit of room
+# above its nominal length). Each frame's windows are scaled from the length
+# of its own leader, which is 16 bits long: the measured leader is multiplied
+# by ratios worked out at compile time, so the interrupt routine only shifts
+# and adds, once at the end of the leader and once at the end of the pause.
+# The leader itself is accepted within 1/8 of a running average, which moves
+# 1/8 of the way towards every leader that is followed by a pause of the
+# right length, and stays within 1/8 of 9ms. So a remote up to 12% off is
+# decoded from its first frame, and one that drifts further, e.g. with
+# temperature or a draining battery, is followed up to 20% off. The 110ms
+# repeat timeout is not scaled, so the repeat codes of a remote more than
+# 12% slow come too far apart, and only its frames are decoded. "make check"
+# tests this, see the Makefile.
+#
+# Note: Requires NEC as the only protocol, NECIR_DECODE_MODE = 0 and
+#       NECIR_ASM_ISR = 0. Adds 11 bytes of RAM per channel. The longest
+#       accepted leader must fit an 8-bit counter, which limits
+#       NECIR_SAMPLES_PER_BIT to 12.
+#
+# 0 = Fixed windows
+# 1 = Windows scaled from the measured leader
+NECIR_ADAPTIVE = 0
+
+# Address filter, for rooms full of other remotes. NEC and Samsung32 frames
+# whose address is not in this list are dropped by the interrupt routine as
+# soon as their address has been received, along with the repeat codes that
+# follow them, so they never take up room on the queue. Addresses are
+# written the way they are queued: the 8-bit address with the standard
+# protocol, or the upper 16 bits of the message with the extended protocol.
+#
+# The check runs in the sampling interrupt, on the tick that completes the
+# address, so it adds to the worst case BIT_PAUSE interrupt. With the
+# standard protocol the list is turned into a 32-byte PROGMEM bitmap at
+# compile time, and the check takes the same few cycles (two lpm reads and
+# a mask) however many addresses are listed, up to 32. With the extended
+# protocol the list is searched in PROGMEM in order, at about 10 cycles per
+# address before the match (two lpm reads, a 16-bit compare and the loop),
+# so keep it short and put the busiest addresses first.
+#
+# Note: Not supported by NECIR_ASM_ISR. SIRC and RC5 frames are not
+#       filtered.
+#
+# (empty) = Accept every address
+# a,b,... = Comma-separated list without spaces, e.g. 0x00,0x04 (standard)
+#           or 0x00FF,0x04FB (extended)
+NECIR_ADDRESS_FILTER =
+
 # NECIR_DELAY_UNTIL_REPEAT defines how many repeats at the native
 # repeat interval of the IR remote (108ms) are skipped before emitting
 # the first repeat, after which the repeats will be emitted every
@@ -75,22 +411,76 @@ IR_PORT = PORTB
 IR_INPUT = PINB
 IR_PIN = PB3
 
+# Multi-channel decoding, for several IR receivers on the same port (for
+# example facing different directions). The whole IR_INPUT port is sampled
+# once per timer interrupt, and every pin in the mask gets its own NEC state
+# machine. Queued messages are tagged with the channel that received them,
+# see NECIR_DequeueWithChannel(); channel 0 is the lowest pin in the mask.
+# IR_PIN is not used when this is enabled.
+#
+# Each extra channel costs about one IDLE state (a few dozen cycles) per
+# interrupt while nothing is received, and 12 bytes of RAM.
+#
+# Note: Requires NECIR_DECODE_MODE = 0 and NECIR_ASM_ISR = 0. The
+#       NECIR_FLAG_REPEAT_TIMEOUT bit of GPIOR0 is not used, every channel
+#       keeps its own flag in RAM.
+#
+#    0 = Decode IR_PIN only
+# 1-255 = Bit mask of the IR_INPUT pins to decode, e.g. 0x0F for pins 0-3
+NECIR_CHANNEL_MASK = 0
+
+# Pin change interrupt group of IR_PIN, only used when NECIR_DECODE_MODE = 1
+# or NECIR_LOW_POWER = 1 on devices with more than one group
+# (ATmega328P: 0 = PORTB, 1 = PORTC, 2 = PORTD). The ATtiny85 only has
+# group 0.
+IR_PCINT_GROUP = 0
+
 # ---------- End NECIR Configuration Section ----------
 
 # ---------- DO NOT MODIFY BELOW THIS LINE ----------
 
 # This avoids adding needless defines if NECIR_USE_GPIOR0 = 0
 ifeq ($(NECIR_USE_GPIOR0), 1)
-NECIR_GPIOR0_DEFINES = -DNECIR_FLAG_REPEAT_TIMEOUT=$(NECIR_FLAG_REPEAT_TIMEOUT)
+NECIR_GPIOR0_DEFINES = -DNECIR_FLAG_REPEAT_TIMEOUT=$(NECIR_FLAG_REPEAT_TIMEOUT) \
+                       -DNECIR_FLAG_ASM_IDLE=$(NECIR_FLAG_ASM_IDLE)
+endif
+
+# This avoids adding a define if NECIR_ADDRESS_FILTER is empty
+ifneq ($(NECIR_ADDRESS_FILTER),)
+NECIR_FILTER_DEFINES = -DNECIR_ADDRESS_FILTER=$(NECIR_ADDRESS_FILTER)
+endif
+
+# The assembly interrupt routine is linked in as an extra object
+ifeq ($(NECIR_ASM_ISR), 1)
+OBJECTS += necir_isr.o
 endif
 
 # This line integrates all NECIR-related defines into a single flag called:
 #     $(NECIR_DEFINES)
 # which should be appended to the definition of COMPILE in the Makefile
 NECIR_DEFINES = -DNECIR_ISR_CTC_TIMER=$(NECIR_ISR_CTC_TIMER) \
+                -DNECIR_SAMPLES_PER_BIT=$(NECIR_SAMPLES_PER_BIT) \
+                -DNECIR_DECODE_MODE=$(NECIR_DECODE_MODE) \
+                -DNECIR_LOW_POWER=$(NECIR_LOW_POWER) \
+                -DNECIR_WAKEUP_CYCLES=$(NECIR_WAKEUP_CYCLES) \
                 -DNECIR_USE_GPIOR0=$(NECIR_USE_GPIOR0) \
+                -DNECIR_ASM_ISR=$(NECIR_ASM_ISR) \
                 -DNECIR_QUEUE_LENGTH=$(NECIR_QUEUE_LENGTH) \
+                -DNECIR_COALESCE_REPEATS=$(NECIR_COALESCE_REPEATS) \
+                -DNECIR_STATS=$(NECIR_STATS) \
+                -DNECIR_EVENTS=$(NECIR_EVENTS) \
+                -DNECIR_DISPATCH=$(NECIR_DISPATCH) \
+                -DNECIR_SCHEDULER=$(NECIR_SCHEDULER) \
+                -DNECIR_TX=$(NECIR_TX) \
+                -DNECIR_TX_QUEUE_LENGTH=$(NECIR_TX_QUEUE_LENGTH) \
+                -DNECIR_CAPTURE=$(NECIR_CAPTURE) \
+                -DNECIR_CAPTURE_LENGTH=$(NECIR_CAPTURE_LENGTH) \
                 -DNECIR_USE_EXTENDED_PROTOCOL=$(NECIR_USE_EXTENDED_PROTOCOL) \
+                -DNECIR_PROTOCOL_NEC=$(NECIR_PROTOCOL_NEC) \
+                -DNECIR_PROTOCOL_SAMSUNG32=$(NECIR_PROTOCOL_SAMSUNG32) \
+                -DNECIR_PROTOCOL_SIRC=$(NECIR_PROTOCOL_SIRC) \
+                -DNECIR_PROTOCOL_RC5=$(NECIR_PROTOCOL_RC5) \
+                -DNECIR_ADAPTIVE=$(NECIR_ADAPTIVE) \
                 -DNECIR_DELAY_UNTIL_REPEAT=$(NECIR_DELAY_UNTIL_REPEAT) \
                 -DNECIR_REPEAT_INTERVAL=$(NECIR_REPEAT_INTERVAL) \
                 -DNECIR_TURBO_MODE_AFTER=$(NECIR_TURBO_MODE_AFTER) \
@@ -99,4 +489,7 @@ NECIR_DEFINES = -DNECIR_ISR_CTC_TIMER=$(NECIR_ISR_CTC_TIMER) \
                 -DIR_PORT=$(IR_PORT) \
                 -DIR_INPUT=$(IR_INPUT) \
                 -DIR_PIN=$(IR_PIN) \
-                $(NECIR_GPIOR0_DEFINES)
+                -DIR_PCINT_GROUP=$(IR_PCINT_GROUP) \
+                -DNECIR_CHANNEL_MASK=$(NECIR_CHANNEL_MASK) \
+                $(NECIR_GPIOR0_DEFINES) \
+                $(NECIR_FILTER_DEFINES)
@@ -0,0 +1,972 @@
+/*
+
+  necir_core.h
+
+  Copyright 2014 Matthew T. Pandina. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY MATTHEW T. PANDINA "AS IS" AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHEW T. PANDINA OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+  SUCH DAMAGE.
+
+*/
+
+// Hardware-independent IR decoder. NECIR_DecoderStep() is the sampled
+// state machine that used to live inside the timer interrupt: it takes one
+// sample of the IR signal (zero = IR burst, non-zero = idle) and returns an
+// event. necir.c calls it from the sampling interrupt, and host/necir_decode.c
+// calls it on recorded pulse traces, so both decode exactly the same way.
+//
+// Everything is static inline so the AVR build compiles down to the same code
+// as before. The includer may define the following hooks first:
+//   NECIR_CORE_GET_REPEAT_TIMEOUT_FLAG(d), NECIR_CORE_SET_REPEAT_TIMEOUT_FLAG(d),
+//   NECIR_CORE_CLEAR_REPEAT_TIMEOUT_FLAG(d): keep the repeat timeout flag
+//     somewhere other than the decoder struct (necir.c uses GPIOR0)
+//   NECIR_CORE_BIT_MASK(n): returns 1 << n for n = 0..7 (necir.c uses a
+//     PROGMEM table, since the AVR can only shift by one bit at a time)
+//   NECIR_CORE_FILTER_STORAGE, NECIR_CORE_READ_FILTER(p): where the address
+//     filter is stored, and how to read an entry of it (necir.c uses PROGMEM)
+
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// NECIR_CTC_PRESCALE, NECIR_CTC_TOP and NECIR_SAMPLE_CYCLES
+#include "necir_timing.h"
+
+// Converts a duration in tenths of a microsecond, or in milliseconds, to
+// whole samples, rounding down. Everything is integer math, so the results
+// are integer constant expressions. Only call these with constants.
+#define NECIR_TIME_TO_SAMPLES(t) ((uint32_t)(t) * (uint32_t)(F_CPU / 1000) / ((uint32_t)NECIR_SAMPLE_CYCLES * 10000))
+#define NECIR_MS_TO_SAMPLES(ms) ((uint32_t)(ms) * (uint32_t)(F_CPU / 1000) / (uint32_t)NECIR_SAMPLE_CYCLES)
+
+// Measured in samples: 110 - 9.0 - 2.25 - 0.5625 ms (idle time between repeats) + leeway
+#define NECIR_SAMPLED_REPEAT_TIMEOUT ((uint16_t)NECIR_MS_TO_SAMPLES(110) + 1)
+_Static_assert(NECIR_MS_TO_SAMPLES(110) + 1 <= UINT16_MAX, "the repeat timeout does not fit its 16-bit counter");
+
+
+// Protocol descriptors, all timings in tenths of a microsecond, so that
+// NEC's 562.5us is a whole number. The state machine below is
+// specialized at compile time for the protocols enabled in necir.mk, so the
+// descriptors fold into constants and nothing is looked up at run time.
+//
+// NEC:       9ms leader burst, 4.5ms pause (2.25ms and a final burst for a
+//            repeat code), then 32 pulse-distance bits LSB-first: a 562.5us
+//            burst followed by a 562.5us (0) or 1.6875ms (1) space, and a
+//            final burst
+// Samsung32: same as NEC, but with a 4.5ms leader and no repeat code; the
+//            whole frame is resent every 108ms while a key is held
+// SIRC:      2.4ms leader burst, then 12, 15 or 20 pulse-width bits
+//            LSB-first: a 600us space followed by a 600us (0) or 1.2ms (1)
+//            burst; the whole frame is resent every 45ms
+// RC5:       14 Manchester-coded bits MSB-first, 889us per half-bit, a
+//            burst in the second half is a 1; the whole frame is resent
+//            every 114ms with the same toggle bit
+#define NECIR_NEC_LEADER 90000
+#define NECIR_NEC_PAUSE 45000
+#define NECIR_NEC_REPEAT_PAUSE 22500
+#define NECIR_NEC_BIT 5625
+#define NECIR_NEC_ONE_PAUSE 16875
+#define NECIR_NEC_BITS 32
+#define NECIR_SAMSUNG32_LEADER 45000
+#define NECIR_SIRC_LEADER 24000
+#define NECIR_SIRC_BIT 6000
+#define NECIR_SIRC_ONE 12000
+#define NECIR_SIRC_MAX_BITS 20
+#define NECIR_RC5_HALF_BIT 8890
+#define NECIR_RC5_BIT 17780
+#define NECIR_RC5_BITS 14
+
+// stateCounter holds the number of samples taken at the current level minus
+// one, so a pulse of 't' normally ends with it at NECIR_SAMPLES(t) - 1 or
+// NECIR_SAMPLES(t). It is accepted between NECIR_MIN(t) and NECIR_MAX(t),
+// and when a pulse can have two lengths, values above NECIR_SPLIT() are the
+// longer one. The window is a bit long below and half a bit long above the
+// nominal length, whatever NECIR_SAMPLES_PER_BIT is, so oversampling only
+// makes the measurement finer, not the receiver pickier.
+#define NECIR_SAMPLES(t) ((uint8_t)NECIR_TIME_TO_SAMPLES(t))
+#define NECIR_MIN(t) (NECIR_SAMPLES(t) - NECIR_SAMPLES_PER_BIT)
+#define NECIR_MAX(t) (NECIR_SAMPLES(t) + NECIR_SAMPLES_PER_BIT / 2)
+#define NECIR_SPLIT(shortT, longT) ((NECIR_SAMPLES(shortT) + NECIR_SAMPLES(longT) - 1) / 2)
+
+// The NEC leader is the longest pulse that is measured, of any protocol
+_Static_assert(NECIR_TIME_TO_SAMPLES(NECIR_NEC_LEADER) + NECIR_SAMPLES_PER_BIT / 2 <= UINT8_MAX, "pulse lengths do not fit the 8-bit stateCounter");
+
+// Protocol numbers, as tagged on queued messages
+enum { NECIR_NEC, NECIR_SAMSUNG32, NECIR_SIRC, NECIR_RC5 };
+
+#define NECIR_PROTOCOL_COUNT (NECIR_PROTOCOL_NEC + NECIR_PROTOCOL_SAMSUNG32 + NECIR_PROTOCOL_SIRC + NECIR_PROTOCOL_RC5)
+
+#if (NECIR_PROTOCOL_COUNT > 1)
+#define NECIR_DecoderProtocol(d) ((d)->protocol)
+#define NECIR_SET_PROTOCOL(d, p) ((d)->protocol = (p))
+#elif (NECIR_PROTOCOL_NEC)
+#define NECIR_DecoderProtocol(d) NECIR_NEC
+#elif (NECIR_PROTOCOL_SAMSUNG32)
+#define NECIR_DecoderProtocol(d) NECIR_SAMSUNG32
+#elif (NECIR_PROTOCOL_SIRC)
+#define NECIR_DecoderProtocol(d) NECIR_SIRC
+#elif (NECIR_PROTOCOL_RC5)
+#define NECIR_DecoderProtocol(d) NECIR_RC5
+#else // NECIR_PROTOCOL_COUNT
+#error "At least one of NECIR_PROTOCOL_NEC, NECIR_PROTOCOL_SAMSUNG32, NECIR_PROTOCOL_SIRC and NECIR_PROTOCOL_RC5 must be 1"
+#endif // NECIR_PROTOCOL_COUNT
+#ifndef NECIR_SET_PROTOCOL
+#define NECIR_SET_PROTOCOL(d, p) ((void)0)
+#endif // NECIR_SET_PROTOCOL
+
+// Protocols that resend the whole frame while a key is held, rather than a repeat code
+#define NECIR_FRAME_REPEATS (NECIR_PROTOCOL_SAMSUNG32 || NECIR_PROTOCOL_SIRC || NECIR_PROTOCOL_RC5)
+
+// The longest leader of the enabled protocols
+#if (NECIR_PROTOCOL_NEC)
+#define NECIR_LEADER_MAX NECIR_MAX(NECIR_NEC_LEADER)
+#elif (NECIR_PROTOCOL_SAMSUNG32)
+#define NECIR_LEADER_MAX NECIR_MAX(NECIR_SAMSUNG32_LEADER)
+#elif (NECIR_PROTOCOL_SIRC)
+#define NECIR_LEADER_MAX NECIR_MAX(NECIR_SIRC_LEADER)
+#else // NECIR_PROTOCOL_RC5
+#define NECIR_LEADER_MAX NECIR_MAX(NECIR_RC5_BIT)
+#endif // NECIR_PROTOCOL_NEC
+
+#if (NECIR_ADAPTIVE)
+#if (NECIR_PROTOCOL_COUNT > 1 || !NECIR_PROTOCOL_NEC)
+#error "NECIR_ADAPTIVE requires NEC as the only protocol"
+#endif // NECIR_PROTOCOL_COUNT
+
+// With NECIR_ADAPTIVE, the windows of a frame are scaled from the number of
+// samples its leader lasted, instead of from the sample period. NECIR_RATIO()
+// is the length of a pulse relative to the 9ms leader in 1/256ths, which
+// comes out as 128, 64, 16 and 48 for the NEC timings, so NECIR_SCALED() is
+// a multiplication by a constant that avr-gcc turns into shifts and adds.
+#define NECIR_RATIO(t) ((uint16_t)(((uint32_t)(t) * 256 + NECIR_NEC_LEADER / 2) / NECIR_NEC_LEADER))
+#define NECIR_SCALED(leader, t) ((uint8_t)(((uint16_t)(leader) * NECIR_RATIO(t)) >> 8))
+#define NECIR_SCALED_MIN(leader, t) (NECIR_SCALED(leader, t) > NECIR_SAMPLES_PER_BIT ? NECIR_SCALED(leader, t) - NECIR_SAMPLES_PER_BIT : 0)
+#define NECIR_SCALED_MAX(leader, t) (NECIR_SCALED(leader, t) + NECIR_SAMPLES_PER_BIT / 2)
+
+// The running average of the leader is kept in 1/16ths of a sample, starts
+// at 9ms and stays within 1/8 of it. A leader is accepted within 1/8 of the
+// average, rounded to whole samples; the window is in stateCounter values,
+// one less than the samples taken.
+#define NECIR_LEADER_NOMINAL ((uint16_t)NECIR_MS_TO_SAMPLES(9 * 16))
+#define NECIR_LEADER_AVERAGE_MIN (NECIR_LEADER_NOMINAL - NECIR_LEADER_NOMINAL / 8)
+#define NECIR_LEADER_AVERAGE_MAX (NECIR_LEADER_NOMINAL + NECIR_LEADER_NOMINAL / 8)
+#define NECIR_LEADER_WINDOW_MIN(average) ((average) - (average) / 8 - 1)
+#define NECIR_LEADER_WINDOW_MAX(average) ((average) + (average) / 8 - 1)
+#define NECIR_ADAPTIVE_LEADER_MAX NECIR_LEADER_WINDOW_MAX((NECIR_LEADER_AVERAGE_MAX + 8) >> 4)
+_Static_assert(NECIR_ADAPTIVE_LEADER_MAX < UINT8_MAX, "NECIR_ADAPTIVE leaders do not fit the 8-bit stateCounter, lower NECIR_SAMPLES_PER_BIT");
+
+// A window of the frame being received, or the fixed one
+#define NECIR_WINDOW(d, field, fixed) ((d)->field)
+#else // NECIR_ADAPTIVE
+#define NECIR_WINDOW(d, field, fixed) (fixed)
+#endif // NECIR_ADAPTIVE
+
+// RC5 has no leader: a frame begins with a burst of one half-bit, or of two
+// when the second start bit is a 0 (RC5X). The longer one comes close to a
+// SIRC leader, so when both are enabled they are split halfway.
+#if (NECIR_PROTOCOL_SIRC)
+#define NECIR_RC5_START_MAX NECIR_SPLIT(NECIR_RC5_BIT, NECIR_SIRC_LEADER)
+#else // NECIR_PROTOCOL_SIRC
+#define NECIR_RC5_START_MAX NECIR_MAX(NECIR_RC5_BIT)
+#endif // NECIR_PROTOCOL_SIRC
+
+#ifndef NECIR_CORE_GET_REPEAT_TIMEOUT_FLAG
+#define NECIR_CORE_REPEAT_TIMEOUT_FLAG_IN_STRUCT
+#define NECIR_CORE_GET_REPEAT_TIMEOUT_FLAG(d) ((d)->repeatTimeoutFlag)
+#define NECIR_CORE_SET_REPEAT_TIMEOUT_FLAG(d) ((d)->repeatTimeoutFlag = true)
+#define NECIR_CORE_CLEAR_REPEAT_TIMEOUT_FLAG(d) ((d)->repeatTimeoutFlag = false)
+#endif // NECIR_CORE_GET_REPEAT_TIMEOUT_FLAG
+
+#ifndef NECIR_CORE_BIT_MASK
+#define NECIR_CORE_BIT_MASK(n) ((uint8_t)(1 << (n)))
+#endif // NECIR_CORE_BIT_MASK
+
+#ifdef NECIR_ADDRESS_FILTER
+#ifndef NECIR_CORE_READ_FILTER
+#define NECIR_CORE_FILTER_STORAGE
+#define NECIR_CORE_READ_FILTER(p) (*(p))
+#endif // NECIR_CORE_READ_FILTER
+
+// The addresses of NEC and Samsung32 frames that are let through, in the
+// same form as they are queued. Any other frame is dropped as soon as its
+// address has been received.
+#if (NECIR_USE_EXTENDED_PROTOCOL)
+#define NECIR_ADDRESS_BITS 16
+static const uint16_t NECIR_addressFilter[] NECIR_CORE_FILTER_STORAGE = { NECIR_ADDRESS_FILTER };
+#else // NECIR_USE_EXTENDED_PROTOCOL
+#define NECIR_ADDRESS_BITS 8
+// A bitmap of the 256 addresses, built from a list of up to 32, so checking
+// an address takes one read and a mask however long the list is. The list
+// is padded with 0x100, which sets no bit, and its 33rd entry must be
+// padding.
+#define NECIR_FILTER_PADDING \
+  0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, \
+  0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, \
+  0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100, 0x100
+#define NECIR_FILTER_BIT(b, a) (((a) >> 3) == (b) ? 1 << ((a) & 7) : 0)
+#define NECIR_FILTER_BYTE_(b, a0, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12, a13, a14, a15, \
+                           a16, a17, a18, a19, a20, a21, a22, a23, a24, a25, a26, a27, a28, a29, a30, a31, ...) \
+  (NECIR_FILTER_BIT(b, a0) | NECIR_FILTER_BIT(b, a1) | NECIR_FILTER_BIT(b, a2) | NECIR_FILTER_BIT(b, a3) | \
+   NECIR_FILTER_BIT(b, a4) | NECIR_FILTER_BIT(b, a5) | NECIR_FILTER_BIT(b, a6) | NECIR_FILTER_BIT(b, a7) | \
+   NECIR_FILTER_BIT(b, a8) | NECIR_FILTER_BIT(b, a9) | NECIR_FILTER_BIT(b, a10) | NECIR_FILTER_BIT(b, a11) | \
+   NECIR_FILTER_BIT(b, a12) | NECIR_FILTER_BIT(b, a13) | NECIR_FILTER_BIT(b, a14) | NECIR_FILTER_BIT(b, a15) | \
+   NECIR_FILTER_BIT(b, a16) | NECIR_FILTER_BIT(b, a17) | NECIR_FILTER_BIT(b, a18) | NECIR_FILTER_BIT(b, a19) | \
+   NECIR_FILTER_BIT(b, a20) | NECIR_FILTER_BIT(b, a21) | NECIR_FILTER_BIT(b, a22) | NECIR_FILTER_BIT(b, a23) | \
+   NECIR_FILTER_BIT(b, a24) | NECIR_FILTER_BIT(b, a25) | NECIR_FILTER_BIT(b, a26) | NECIR_FILTER_BIT(b, a27) | \
+   NECIR_FILTER_BIT(b, a28) | NECIR_FILTER_BIT(b, a29) | NECIR_FILTER_BIT(b, a30) | NECIR_FILTER_BIT(b, a31))
+#define NECIR_FILTER_BYTE_LIST(b, ...) NECIR_FILTER_BYTE_(b, __VA_ARGS__)
+#define NECIR_FILTER_BYTE(b) NECIR_FILTER_BYTE_LIST(b, NECIR_ADDRESS_FILTER, NECIR_FILTER_PADDING)
+#define NECIR_FILTER_33RD_(a0, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10, a11, a12, a13, a14, a15, \
+                           a16, a17, a18, a19, a20, a21, a22, a23, a24, a25, a26, a27, a28, a29, a30, a31, a32, ...) a32
+#define NECIR_FILTER_33RD(...) NECIR_FILTER_33RD_(__VA_ARGS__)
+_Static_assert(NECIR_FILTER_33RD(NECIR_ADDRESS_FILTER, NECIR_FILTER_PADDING) == 0x100,
+               "NECIR_ADDRESS_FILTER lists more than 32 addresses");
+static const uint8_t NECIR_addressFilter[32] NECIR_CORE_FILTER_STORAGE = {
+  NECIR_FILTER_BYTE(0), NECIR_FILTER_BYTE(1), NECIR_FILTER_BYTE(2), NECIR_FILTER_BYTE(3),
+  NECIR_FILTER_BYTE(4), NECIR_FILTER_BYTE(5), NECIR_FILTER_BYTE(6), NECIR_FILTER_BYTE(7),
+  NECIR_FILTER_BYTE(8), NECIR_FILTER_BYTE(9), NECIR_FILTER_BYTE(10), NECIR_FILTER_BYTE(11),
+  NECIR_FILTER_BYTE(12), NECIR_FILTER_BYTE(13), NECIR_FILTER_BYTE(14), NECIR_FILTER_BYTE(15),
+  NECIR_FILTER_BYTE(16), NECIR_FILTER_BYTE(17), NECIR_FILTER_BYTE(18), NECIR_FILTER_BYTE(19),
+  NECIR_FILTER_BYTE(20), NECIR_FILTER_BYTE(21), NECIR_FILTER_BYTE(22), NECIR_FILTER_BYTE(23),
+  NECIR_FILTER_BYTE(24), NECIR_FILTER_BYTE(25), NECIR_FILTER_BYTE(26), NECIR_FILTER_BYTE(27),
+  NECIR_FILTER_BYTE(28), NECIR_FILTER_BYTE(29), NECIR_FILTER_BYTE(30), NECIR_FILTER_BYTE(31)
+};
+#endif // NECIR_USE_EXTENDED_PROTOCOL
+#endif // NECIR_ADDRESS_FILTER
+
+enum { NECIR_STATE_WAITING_FOR_IDLE, NECIR_STATE_IDLE,
+       NECIR_STATE_LEADER, NECIR_STATE_PAUSE,
+       NECIR_STATE_BIT_LEADER, NECIR_STATE_BIT_PAUSE,
+       NECIR_STATE_PROCESS, NECIR_STATE_PROCESS2,
+       NECIR_STATE_REPEAT_PROCESS, NECIR_STATE_REPEAT_PROCESS2,
+       NECIR_STATE_SIRC_SPACE, NECIR_STATE_SIRC_MARK,
+       NECIR_STATE_MANCHESTER };
+
+// Returned by NECIR_DecoderStep(). A MESSAGE or REPEAT event is always
+// followed by the matching COMMIT event on the next sample, unless the caller
+// calls NECIR_DecoderDrop() in between. This lets the interrupt routine split
+// an enqueue across two samples to keep its maximum running time down; other
+// callers can act on MESSAGE and REPEAT and ignore the rest.
+enum { NECIR_EVENT_NONE,
+       NECIR_EVENT_IDLE, // idle, and repeat codes are no longer accepted, so there is nothing left to time
+       NECIR_EVENT_MESSAGE, // 'message' holds the raw bits of a new message, see NECIR_DecoderValue()
+       NECIR_EVENT_MESSAGE_COMMIT,
+       NECIR_EVENT_REPEAT, // 'message' still holds the last message, and a repeat should be passed on
+       NECIR_EVENT_REPEAT_COMMIT };
+
+#if (NECIR_STATS)
+#if (NECIR_STATS == 2)
+// One bin for every stateCounter value up to NECIR_MAX() of a pulse, or up
+// to its scaled window after the longest leader NECIR_ADAPTIVE accepts
+#if (NECIR_ADAPTIVE)
+#define NECIR_STATS_BINS(t) (NECIR_SCALED_MAX(NECIR_ADAPTIVE_LEADER_MAX + 1, t) + 1)
+#else // NECIR_ADAPTIVE
+#define NECIR_STATS_BINS(t) (NECIR_MAX(t) + 1)
+#endif // NECIR_ADAPTIVE
+
+// The longest leader, and the longest pulse within a frame, of the enabled protocols
+#if (NECIR_PROTOCOL_NEC)
+#define NECIR_STATS_LEADER_BINS NECIR_STATS_BINS(NECIR_NEC_LEADER)
+#elif (NECIR_PROTOCOL_SAMSUNG32)
+#define NECIR_STATS_LEADER_BINS NECIR_STATS_BINS(NECIR_SAMSUNG32_LEADER)
+#elif (NECIR_PROTOCOL_SIRC)
+#define NECIR_STATS_LEADER_BINS NECIR_STATS_BINS(NECIR_SIRC_LEADER)
+#else // NECIR_PROTOCOL_NEC
+#define NECIR_STATS_LEADER_BINS NECIR_STATS_BINS(NECIR_RC5_BIT)
+#endif // NECIR_PROTOCOL_NEC
+#if (NECIR_PROTOCOL_RC5)
+#define NECIR_STATS_BIT_BINS NECIR_STATS_BINS(NECIR_RC5_BIT)
+#elif (NECIR_PROTOCOL_NEC || NECIR_PROTOCOL_SAMSUNG32)
+#define NECIR_STATS_BIT_BINS NECIR_STATS_BINS(NECIR_NEC_ONE_PAUSE)
+#else // NECIR_PROTOCOL_RC5
+#define NECIR_STATS_BIT_BINS NECIR_STATS_BINS(NECIR_SIRC_ONE)
+#endif // NECIR_PROTOCOL_RC5
+#endif // NECIR_STATS
+
+// Decoder health counters, all saturating. The histograms count how often a
+// pulse ended with stateCounter at each value, whether it was accepted or not.
+typedef struct {
+  uint16_t messages; // messages put on the queue
+  uint16_t repeats; // repeats put on the queue, or counted on a queue entry by NECIR_COALESCE_REPEATS
+  uint16_t messagesDropped; // messages dropped because the queue was full
+  uint16_t repeatsDropped; // repeats dropped because the queue was full
+  uint16_t invalid; // messages that failed the inverse bit check
+  uint16_t addressRejected; // frames dropped by NECIR_ADDRESS_FILTER
+  uint16_t leaderErrors; // bursts that were too short or too long to be a leader
+  uint16_t pauseErrors; // pauses after a leader that were too short or too long
+  uint16_t bitBurstErrors; // bursts within a frame that were too short or too long
+  uint16_t bitSpaceErrors; // spaces within a frame that were too short or too long, and frames that ended early
+  uint8_t queueHighWater; // the most entries ever waiting on the queue
+#if (NECIR_STATS == 2)
+  uint16_t leaderHistogram[NECIR_STATS_LEADER_BINS];
+#if (NECIR_PROTOCOL_NEC || NECIR_PROTOCOL_SAMSUNG32)
+  uint16_t pauseHistogram[NECIR_STATS_BINS(NECIR_NEC_PAUSE)];
+#endif // NECIR_PROTOCOL_NEC || NECIR_PROTOCOL_SAMSUNG32
+  uint16_t bitBurstHistogram[NECIR_STATS_BIT_BINS];
+  uint16_t bitSpaceHistogram[NECIR_STATS_BIT_BINS];
+#endif // NECIR_STATS
+} necir_stats_t;
+
+#define NECIR_STATS_COUNT(d, counter) do { if (!++(d)->stats.counter) --(d)->stats.counter; } while (0)
+#else // NECIR_STATS
+#define NECIR_STATS_COUNT(d, counter) ((void)0)
+#endif // NECIR_STATS
+
+#if (NECIR_STATS == 2)
+#define NECIR_STATS_MEASURED(d, histogram) do { if (!++(d)->stats.histogram[(d)->stateCounter]) --(d)->stats.histogram[(d)->stateCounter]; } while (0)
+#else // NECIR_STATS
+#define NECIR_STATS_MEASURED(d, histogram) ((void)0)
+#endif // NECIR_STATS
+
+typedef struct {
+  uint8_t state;
+  uint8_t stateCounter; // stores the number of times we have sampled the state minus one
+  uint8_t messageBit; // we pre-calculate this value in the BIT_LEADER state, so the BIT_PAUSE state can execute faster
+  uint8_t bitCounter; // keeps track of how many bits we've currently decoded
+  uint16_t repeatTimeout; // timeout for when we no longer accept repeat codes for a given command
+  uint8_t nativeRepeatsNeeded; // counts down the number of native repeat messages seen; when zero, emits a repeat to the application
+#if (NECIR_TURBO_MODE_AFTER != 0)
+  uint8_t turboModeCounter;
+#endif // NECIR_TURBO_MODE_AFTER
+#ifdef NECIR_CORE_REPEAT_TIMEOUT_FLAG_IN_STRUCT
+  bool repeatTimeoutFlag;
+#endif // NECIR_CORE_REPEAT_TIMEOUT_FLAG_IN_STRUCT
+#if (NECIR_PROTOCOL_COUNT > 1)
+  uint8_t protocol; // protocol of the message being received, chosen by the length of its leader
+  uint8_t lastProtocol; // protocol of the last message passed on, the only one whose repeats are accepted
+#endif // NECIR_PROTOCOL_COUNT
+  uint8_t message[4]; // stores the decoded bits, LSB-first (RC5 is shifted in MSB-first)
+#if (NECIR_ADAPTIVE)
+  uint16_t leaderAverage; // running average of the leaders received, in 1/16ths of a sample
+  uint8_t leaderMin, leaderMax; // window of the next leader, from leaderAverage
+  uint8_t leader; // samples taken during the leader of this frame
+  uint8_t pauseMax, repeatPauseMin, repeatPauseMax; // windows scaled from 'leader' at the end of the leader
+  uint8_t bitMin, bitMax, onePauseMax; // and at the end of the pause
+#endif // NECIR_ADAPTIVE
+#if (NECIR_FRAME_REPEATS)
+  uint8_t lastMessage[4]; // the last message passed on, to recognize a resent frame as a repeat
+#endif // NECIR_FRAME_REPEATS
+#if (NECIR_STATS)
+  necir_stats_t stats;
+#endif // NECIR_STATS
+} necir_decoder_t;
+
+// Puts the decoder into its power-on state: waiting for the IR signal to go
+// idle, with repeats disallowed until a valid command has been seen
+static inline void NECIR_DecoderInit(necir_decoder_t *d) __attribute__(( always_inline ));
+static inline void NECIR_DecoderInit(necir_decoder_t *d) {
+  d->state = NECIR_STATE_WAITING_FOR_IDLE;
+  NECIR_CORE_SET_REPEAT_TIMEOUT_FLAG(d);
+#if (NECIR_ADAPTIVE)
+  d->leaderAverage = NECIR_LEADER_NOMINAL;
+  d->leaderMin = NECIR_LEADER_WINDOW_MIN((NECIR_LEADER_NOMINAL + 8) >> 4);
+  d->leaderMax = NECIR_LEADER_WINDOW_MAX((NECIR_LEADER_NOMINAL + 8) >> 4);
+#endif // NECIR_ADAPTIVE
+}
+
+#if (NECIR_ADAPTIVE)
+// Called at the end of a leader, scales the windows of the pause from it
+static inline void NECIR_DecoderScalePause(necir_decoder_t *d) __attribute__(( always_inline ));
+static inline void NECIR_DecoderScalePause(necir_decoder_t *d) {
+  uint8_t leader = d->stateCounter + 1;
+  d->leader = leader;
+  d->pauseMax = NECIR_SCALED_MAX(leader, NECIR_NEC_PAUSE);
+  d->repeatPauseMin = NECIR_SCALED_MIN(leader, NECIR_NEC_REPEAT_PAUSE);
+  d->repeatPauseMax = NECIR_SCALED_MAX(leader, NECIR_NEC_REPEAT_PAUSE);
+}
+
+// Called once a pause of the right length has confirmed the leader, moves
+// the running average 1/8 of the way towards it
+static inline void NECIR_DecoderAverageLeader(necir_decoder_t *d) __attribute__(( always_inline ));
+static inline void NECIR_DecoderAverageLeader(necir_decoder_t *d) {
+  int16_t difference = (int16_t)(((uint16_t)d->leader << 4) - d->leaderAverage);
+  uint16_t average = d->leaderAverage + (difference >> 3);
+  if (average < NECIR_LEADER_AVERAGE_MIN)
+    average = NECIR_LEADER_AVERAGE_MIN;
+  else if (average > NECIR_LEADER_AVERAGE_MAX)
+    average = NECIR_LEADER_AVERAGE_MAX;
+  d->leaderAverage = average;
+  uint8_t samples = (average + 8) >> 4;
+  d->leaderMin = NECIR_LEADER_WINDOW_MIN(samples);
+  d->leaderMax = NECIR_LEADER_WINDOW_MAX(samples);
+}
+
+// Called at the end of the pause before the first bit, scales the windows of the bits
+static inline void NECIR_DecoderScaleBits(necir_decoder_t *d) __attribute__(( always_inline ));
+static inline void NECIR_DecoderScaleBits(necir_decoder_t *d) {
+  uint8_t leader = d->leader;
+  d->bitMin = NECIR_SCALED_MIN(leader, NECIR_NEC_BIT);
+  d->bitMax = NECIR_SCALED_MAX(leader, NECIR_NEC_BIT);
+  d->onePauseMax = NECIR_SCALED_MAX(leader, NECIR_NEC_ONE_PAUSE);
+}
+#endif // NECIR_ADAPTIVE
+
+#ifdef NECIR_ADDRESS_FILTER
+// Called once the first NECIR_ADDRESS_BITS bits of a NEC or Samsung32 frame have been received
+static inline bool NECIR_DecoderAddressAllowed(const necir_decoder_t *d) __attribute__(( always_inline ));
+static inline bool NECIR_DecoderAddressAllowed(const necir_decoder_t *d) {
+#if (NECIR_USE_EXTENDED_PROTOCOL)
+  uint16_t address = ((uint16_t)d->message[0] << 8) | d->message[1];
+  for (uint8_t i = 0; i < sizeof(NECIR_addressFilter) / sizeof(NECIR_addressFilter[0]); ++i)
+    if (NECIR_CORE_READ_FILTER(&NECIR_addressFilter[i]) == address)
+      return true;
+  return false;
+#else // NECIR_USE_EXTENDED_PROTOCOL
+  uint8_t address = d->message[0];
+  return NECIR_CORE_READ_FILTER(&NECIR_addressFilter[address >> 3]) & NECIR_CORE_BIT_MASK(address & 7);
+#endif // NECIR_USE_EXTENDED_PROTOCOL
+}
+
+// Drops a frame for another device, along with the repeat codes that follow it
+static inline void NECIR_DecoderRejectAddress(necir_decoder_t *d) __attribute__(( always_inline ));
+static inline void NECIR_DecoderRejectAddress(necir_decoder_t *d) {
+  NECIR_STATS_COUNT(d, addressRejected);
+  NECIR_CORE_SET_REPEAT_TIMEOUT_FLAG(d);
+  d->state = NECIR_STATE_WAITING_FOR_IDLE;
+}
+#endif // NECIR_ADDRESS_FILTER
+
+// Called once the leader of a frame has been received
+static inline void NECIR_DecoderBeginFrame(necir_decoder_t *d) __attribute__(( always_inline ));
+static inline void NECIR_DecoderBeginFrame(necir_decoder_t *d) {
+  d->bitCounter = d->message[0] = d->message[1] = d->message[2] = d->message[3] = 0;
+}
+
+// Called once the leader and pause of a full NEC message have been received
+static inline void NECIR_DecoderBeginMessage(necir_decoder_t *d, uint16_t repeatTimeout) __attribute__(( always_inline ));
+static inline void NECIR_DecoderBeginMessage(necir_decoder_t *d, uint16_t repeatTimeout) {
+  d->repeatTimeout = repeatTimeout;
+  NECIR_CORE_CLEAR_REPEAT_TIMEOUT_FLAG(d); // since we are receiving a new message, allow repeat codes
+  NECIR_DecoderBeginFrame(d);
+}
+
+// Called once all bits of a new message have been received, before it is passed on
+static inline void NECIR_DecoderBeginRepeats(necir_decoder_t *d) __attribute__(( always_inline ));
+static inline void NECIR_DecoderBeginRepeats(necir_decoder_t *d) {
+#if (NECIR_TURBO_MODE_AFTER != 0)
+  d->turboModeCounter = 0;
+#endif // NECIR_TURBO_MODE_AFTER
+  d->nativeRepeatsNeeded = NECIR_DELAY_UNTIL_REPEAT; // set "delay until repeat" length
+}
+
+// Called once a repeat code has been received, returns true if a repeat should be passed back to the application
+static inline bool NECIR_DecoderRepeatCodeReceived(necir_decoder_t *d, uint16_t repeatTimeout) __attribute__(( always_inline ));
+static inline bool NECIR_DecoderRepeatCodeReceived(necir_decoder_t *d, uint16_t repeatTimeout) {
+  if (!NECIR_CORE_GET_REPEAT_TIMEOUT_FLAG(d)) { // are repeat codes are still allowed for this command?
+    d->repeatTimeout = repeatTimeout;
+    if (--d->nativeRepeatsNeeded == 0) { // have we seen enough native repeat messages to pass one back to the application?
+      d->nativeRepeatsNeeded = NECIR_REPEAT_INTERVAL; // "delay until repeat" has been satisfied, so now we set the repeat interval
+#if (NECIR_TURBO_MODE_AFTER != 0)
+      if (++d->turboModeCounter == NECIR_TURBO_MODE_AFTER) { // have we repeated enough to activate turbo mode?
+        --d->turboModeCounter; // ensure that we stay in turbo mode
+        d->nativeRepeatsNeeded = NECIR_TURBO_REPEAT_INTERVAL; // set the turbo mode repeat interval
+      }
+#endif // NECIR_TURBO_MODE_AFTER
+      return true;
+    }
+  }
+  return false;
+}
+
+#if (NECIR_PROTOCOL_COUNT > 1)
+// Repeats are only accepted for the protocol of the last message passed on
+#define NECIR_DecoderRepeatsAllowed(d) ((d)->lastProtocol == NECIR_DecoderProtocol(d))
+#else // NECIR_PROTOCOL_COUNT
+#define NECIR_DecoderRepeatsAllowed(d) true
+#endif // NECIR_PROTOCOL_COUNT
+
+#if (NECIR_FRAME_REPEATS)
+// Called when a new message is passed on. Every protocol decodes into
+// 'message', so the message has to be kept elsewhere for the repeats that
+// follow it.
+static inline void NECIR_DecoderRememberMessage(necir_decoder_t *d) __attribute__(( always_inline ));
+static inline void NECIR_DecoderRememberMessage(necir_decoder_t *d) {
+  d->lastMessage[0] = d->message[0];
+  d->lastMessage[1] = d->message[1];
+  d->lastMessage[2] = d->message[2];
+  d->lastMessage[3] = d->message[3];
+#if (NECIR_PROTOCOL_COUNT > 1)
+  d->lastProtocol = d->protocol;
+#endif // NECIR_PROTOCOL_COUNT
+}
+
+// Called once a whole frame of a protocol without repeat codes has been
+// received. The same frame again, before the repeat timeout expired, counts
+// as a repeat code. Returns NECIR_EVENT_MESSAGE, NECIR_EVENT_REPEAT or
+// NECIR_EVENT_NONE.
+static inline uint8_t NECIR_DecoderFrameReceived(necir_decoder_t *d, uint16_t repeatTimeout) __attribute__(( always_inline ));
+static inline uint8_t NECIR_DecoderFrameReceived(necir_decoder_t *d, uint16_t repeatTimeout) {
+  if (!NECIR_CORE_GET_REPEAT_TIMEOUT_FLAG(d) && NECIR_DecoderRepeatsAllowed(d) &&
+      d->message[0] == d->lastMessage[0] && d->message[1] == d->lastMessage[1] &&
+      d->message[2] == d->lastMessage[2] && d->message[3] == d->lastMessage[3])
+    return NECIR_DecoderRepeatCodeReceived(d, repeatTimeout) ? NECIR_EVENT_REPEAT : NECIR_EVENT_NONE;
+
+  NECIR_DecoderRememberMessage(d);
+  d->repeatTimeout = repeatTimeout;
+  NECIR_CORE_CLEAR_REPEAT_TIMEOUT_FLAG(d); // since we received a new message, allow repeats
+  NECIR_DecoderBeginRepeats(d);
+  return NECIR_EVENT_MESSAGE;
+}
+#endif // NECIR_FRAME_REPEATS
+
+#if (NECIR_PROTOCOL_RC5)
+// Counts a Manchester code error on the level of the run that just ended
+static inline void NECIR_DecoderManchesterError(necir_decoder_t *d) __attribute__(( always_inline ));
+static inline void NECIR_DecoderManchesterError(necir_decoder_t *d) {
+#if (NECIR_STATS)
+  if (d->messageBit)
+    NECIR_STATS_COUNT(d, bitSpaceErrors);
+  else
+    NECIR_STATS_COUNT(d, bitBurstErrors);
+#else // NECIR_STATS
+  (void)d;
+#endif // NECIR_STATS
+}
+
+// Shifts one bit into the low 16 bits of 'message', MSB-first
+static inline void NECIR_DecoderShiftBit(necir_decoder_t *d, uint8_t bit) __attribute__(( always_inline ));
+static inline void NECIR_DecoderShiftBit(necir_decoder_t *d, uint8_t bit) {
+  uint16_t bits = (((uint16_t)d->message[1] << 8) | d->message[0]) << 1;
+  d->message[0] = bits | bit;
+  d->message[1] = bits >> 8;
+}
+#endif // NECIR_PROTOCOL_RC5
+
+// Converts the raw bits of a received message into the value that is passed
+// to the application, returns false if the message fails validation.
+//   NEC, Samsung32: the 32 raw bits with the first byte received in the top
+//                   byte (extended protocol), otherwise address << 8 | command
+//   SIRC:           address << 8 | command, plus the 8 extended bits of a
+//                   20-bit frame << 16 (extended protocol only)
+//   RC5:            address << 8 | command, with the inverted second start
+//                   bit as command bit 6 (RC5X)
+static inline bool NECIR_DecoderValue(const necir_decoder_t *d, uint32_t *value) __attribute__(( always_inline ));
+static inline bool NECIR_DecoderValue(const necir_decoder_t *d, uint32_t *value) {
+  const uint8_t *m = d->message;
+
+  switch (NECIR_DecoderProtocol(d)) {
+#if (NECIR_PROTOCOL_NEC || NECIR_PROTOCOL_SAMSUNG32)
+  case NECIR_NEC:
+  case NECIR_SAMSUNG32:
+#if (NECIR_USE_EXTENDED_PROTOCOL)
+    *value = ((uint32_t)m[0] << 24) | ((uint32_t)m[1] << 16) | ((uint16_t)m[2] << 8) | m[3];
+#else // NECIR_USE_EXTENDED_PROTOCOL
+    if ((m[2] ^ m[3]) != 0xFF) // validate the inverse command
+      return false;
+    if (NECIR_DecoderProtocol(d) == NECIR_NEC ? (m[0] ^ m[1]) != 0xFF : m[0] != m[1]) // NEC sends the inverse address, Samsung32 the address twice
+      return false;
+    *value = ((uint16_t)m[0] << 8) | m[2];
+#endif // NECIR_USE_EXTENDED_PROTOCOL
+    return true;
+#endif // NECIR_PROTOCOL_NEC || NECIR_PROTOCOL_SAMSUNG32
+#if (NECIR_PROTOCOL_SIRC)
+  case NECIR_SIRC: {
+    uint32_t bits = m[0] | ((uint16_t)m[1] << 8) | ((uint32_t)m[2] << 16);
+    *value = bits & 0x7F; // 7-bit command
+    if (d->bitCounter == 15)
+      *value |= ((bits >> 7) & 0xFF) << 8; // 8-bit address
+    else {
+      *value |= ((bits >> 7) & 0x1F) << 8; // 5-bit address
+#if (NECIR_USE_EXTENDED_PROTOCOL)
+      *value |= ((bits >> 12) & 0xFF) << 16; // extended bits, zero for a 12-bit frame
+#endif // NECIR_USE_EXTENDED_PROTOCOL
+    }
+    return true;
+  }
+#endif // NECIR_PROTOCOL_SIRC
+#if (NECIR_PROTOCOL_RC5)
+  case NECIR_RC5: {
+    uint16_t bits = ((uint16_t)m[1] << 8) | m[0]; // S1 S2 T A4-A0 C5-C0
+    *value = (((bits >> 6) & 0x1F) << 8) | (bits & 0x3F) | ((bits & 0x1000) ? 0 : 0x40);
+    return true;
+  }
+#endif // NECIR_PROTOCOL_RC5
+  }
+  return false;
+}
+
+// Cancels the COMMIT event that follows a MESSAGE or REPEAT event, for when
+// the caller had no room for it
+static inline void NECIR_DecoderDrop(necir_decoder_t *d) __attribute__(( always_inline ));
+static inline void NECIR_DecoderDrop(necir_decoder_t *d) {
+  d->state = NECIR_STATE_WAITING_FOR_IDLE;
+}
+
+// Depending on NECIR_SAMPLES_PER_BIT and F_CPU, the lower bound of a short
+// pulse can come out as zero, which makes its check always false
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wtype-limits"
+
+// Feeds one sample, taken every NECIR_SAMPLE_CYCLES clock cycles, to the decoder
+static inline uint8_t NECIR_DecoderStep(necir_decoder_t *d, uint8_t sample) __attribute__(( always_inline ));
+static inline uint8_t NECIR_DecoderStep(necir_decoder_t *d, uint8_t sample) {
+  switch (d->state) {
+  case NECIR_STATE_WAITING_FOR_IDLE: // IR was low, waiting for high
+    if (sample) // if high now, switch to idle state
+      d->state = NECIR_STATE_IDLE;
+    break;
+  case NECIR_STATE_IDLE: // IR was high, waiting for low
+    // If we haven't hit the timeout for when we no longer accept repeats yet, decrement the timeout counter and check
+    if (!NECIR_CORE_GET_REPEAT_TIMEOUT_FLAG(d) && --d->repeatTimeout == 0)
+      NECIR_CORE_SET_REPEAT_TIMEOUT_FLAG(d);
+    if (!sample) { // if low now, reset the counter, and switch to leader state
+      d->stateCounter = 0;
+      d->state = NECIR_STATE_LEADER;
+    } else if (NECIR_CORE_GET_REPEAT_TIMEOUT_FLAG(d))
+      return NECIR_EVENT_IDLE;
+    break;
+  case NECIR_STATE_LEADER: // IR was low, needs to be low for as long as the leader of an enabled protocol
+    if (!sample) { // if low now, make sure it hasn't been low for too long
+      if (++d->stateCounter > NECIR_WINDOW(d, leaderMax, NECIR_LEADER_MAX)) {
+        NECIR_STATS_COUNT(d, leaderErrors);
+        d->state = NECIR_STATE_WAITING_FOR_IDLE; // low for too long, switch to wait for idle state
+      }
+    } else { // if high now, find the protocol whose leader was this long
+      NECIR_STATS_MEASURED(d, leaderHistogram);
+#if (NECIR_PROTOCOL_NEC)
+      if (d->stateCounter >= NECIR_WINDOW(d, leaderMin, NECIR_MIN(NECIR_NEC_LEADER))) { // was low for 9ms, switch to pause state
+        NECIR_SET_PROTOCOL(d, NECIR_NEC);
+#if (NECIR_ADAPTIVE)
+        NECIR_DecoderScalePause(d);
+#endif // NECIR_ADAPTIVE
+        d->stateCounter = 0;
+        d->state = NECIR_STATE_PAUSE;
+        break;
+      }
+#endif // NECIR_PROTOCOL_NEC
+#if (NECIR_PROTOCOL_SAMSUNG32)
+      if (d->stateCounter >= NECIR_MIN(NECIR_SAMSUNG32_LEADER) && d->stateCounter <= NECIR_MAX(NECIR_SAMSUNG32_LEADER)) { // was low for 4.5ms, switch to pause state
+        NECIR_SET_PROTOCOL(d, NECIR_SAMSUNG32);
+        d->stateCounter = 0;
+        d->state = NECIR_STATE_PAUSE;
+        break;
+      }
+#endif // NECIR_PROTOCOL_SAMSUNG32
+#if (NECIR_PROTOCOL_RC5)
+      if (d->stateCounter >= NECIR_MIN(NECIR_RC5_HALF_BIT) && d->stateCounter <= NECIR_RC5_START_MAX) { // was low for the second half of the first start bit, and perhaps the first half of the second
+        NECIR_SET_PROTOCOL(d, NECIR_RC5);
+        NECIR_DecoderBeginFrame(d);
+        d->message[0] = 1; // the first start bit
+        d->bitCounter = d->stateCounter > NECIR_SPLIT(NECIR_RC5_HALF_BIT, NECIR_RC5_BIT) ? 3 : 2; // the half-bit the high run that just began started on
+        d->messageBit = sample;
+        d->stateCounter = 0;
+        d->state = NECIR_STATE_MANCHESTER;
+        break;
+      }
+#endif // NECIR_PROTOCOL_RC5
+#if (NECIR_PROTOCOL_SIRC)
+      if (d->stateCounter >= NECIR_MIN(NECIR_SIRC_LEADER) && d->stateCounter <= NECIR_MAX(NECIR_SIRC_LEADER)) { // was low for 2.4ms, switch to bit space state
+        NECIR_SET_PROTOCOL(d, NECIR_SIRC);
+        NECIR_DecoderBeginFrame(d);
+        d->stateCounter = 0;
+        d->state = NECIR_STATE_SIRC_SPACE;
+        break;
+      }
+#endif // NECIR_PROTOCOL_SIRC
+      NECIR_STATS_COUNT(d, leaderErrors);
+      d->state = NECIR_STATE_IDLE; // was not low for long enough, switch to idle state
+    }
+    break;
+#if (NECIR_PROTOCOL_NEC || NECIR_PROTOCOL_SAMSUNG32)
+  case NECIR_STATE_PAUSE: // IR was high, needs to be high for 4.5ms, or 2.25ms for repeat code
+    if (sample) { // if high now, make sure it hasn't been high for too long
+      if (++d->stateCounter > NECIR_WINDOW(d, pauseMax, NECIR_MAX(NECIR_NEC_PAUSE))) {
+        NECIR_STATS_COUNT(d, pauseErrors);
+        d->state = NECIR_STATE_IDLE; // high for too long, switch to idle state
+      }
+    } else { // if low now, make sure that it was high for long enough
+      NECIR_STATS_MEASURED(d, pauseHistogram);
+      if (d->stateCounter < NECIR_WINDOW(d, repeatPauseMin, NECIR_MIN(NECIR_NEC_REPEAT_PAUSE))) {
+        NECIR_STATS_COUNT(d, pauseErrors);
+        d->state = NECIR_STATE_WAITING_FOR_IDLE; // was not high for long enough, switch to wait for idle state
+        break;
+      }
+#if (NECIR_ADAPTIVE)
+      NECIR_DecoderAverageLeader(d);
+#endif // NECIR_ADAPTIVE
+      if (d->stateCounter > NECIR_WINDOW(d, repeatPauseMax, NECIR_MAX(NECIR_NEC_REPEAT_PAUSE))) { // was high for longer than a repeat code, so switch to bit leader state
+#if (NECIR_ADAPTIVE)
+        NECIR_DecoderScaleBits(d);
+#endif // NECIR_ADAPTIVE
+        if (NECIR_DecoderProtocol(d) == NECIR_NEC)
+          NECIR_DecoderBeginMessage(d, NECIR_SAMPLED_REPEAT_TIMEOUT);
+        else
+          NECIR_DecoderBeginFrame(d); // Samsung32 handles repeats once the frame is complete
+        d->stateCounter = 0;
+        d->state = NECIR_STATE_BIT_LEADER;
+      } else { // was a repeat code
+        d->state = NECIR_STATE_WAITING_FOR_IDLE;
+        if (NECIR_DecoderProtocol(d) == NECIR_NEC && NECIR_DecoderRepeatsAllowed(d) &&
+            NECIR_DecoderRepeatCodeReceived(d, NECIR_SAMPLED_REPEAT_TIMEOUT)) { // have we seen enough native repeat messages to pass one back to the application?
+#if (NECIR_PROTOCOL_NEC && NECIR_FRAME_REPEATS)
+          d->message[0] = d->lastMessage[0]; // another protocol may have begun a frame since
+          d->message[1] = d->lastMessage[1];
+          d->message[2] = d->lastMessage[2];
+          d->message[3] = d->lastMessage[3];
+#endif // NECIR_PROTOCOL_NEC && NECIR_FRAME_REPEATS
+          d->state = NECIR_STATE_REPEAT_PROCESS; // keep the maximum execution time of the ISR down by passing the message on in a new state
+        }
+      }
+    }
+    break;
+#endif // NECIR_PROTOCOL_NEC || NECIR_PROTOCOL_SAMSUNG32
+  case NECIR_STATE_REPEAT_PROCESS:
+    d->state = NECIR_STATE_REPEAT_PROCESS2; // split the enqueue across two states to decrease the maximum running time of the ISR
+    return NECIR_EVENT_REPEAT;
+  case NECIR_STATE_REPEAT_PROCESS2:
+    d->state = NECIR_STATE_WAITING_FOR_IDLE;
+    return NECIR_EVENT_REPEAT_COMMIT;
+#if (NECIR_PROTOCOL_NEC || NECIR_PROTOCOL_SAMSUNG32)
+  case NECIR_STATE_BIT_LEADER: // IR was low, needs to be low for 562.5us
+    if (!sample) { // if low now, make sure it hasn't been low for too long
+      if (++d->stateCounter > NECIR_WINDOW(d, bitMax, NECIR_MAX(NECIR_NEC_BIT))) {
+        NECIR_STATS_COUNT(d, bitBurstErrors);
+        d->state = NECIR_STATE_WAITING_FOR_IDLE; // low for too long, switch to wait for idle state
+      }
+    } else { // if high now, make sure that it was low for long enough
+      NECIR_STATS_MEASURED(d, bitBurstHistogram);
+      if (d->stateCounter < NECIR_WINDOW(d, bitMin, NECIR_MIN(NECIR_NEC_BIT))) {
+        NECIR_STATS_COUNT(d, bitBurstErrors);
+        d->state = NECIR_STATE_IDLE; // was not low for long enough, switch to idle state
+      } else  { // was low for 562.5us, switch to bit pause state
+        d->stateCounter = 0;
+        d->messageBit = NECIR_CORE_BIT_MASK(d->bitCounter % 8); // pre-calculate the value we might need in the next state to make it faster
+        d->state = NECIR_STATE_BIT_PAUSE;
+      }
+    }
+    break;
+  case NECIR_STATE_BIT_PAUSE: // IR was high, needs to be high for either 562.5us (0-bit) or 1.6875ms (1-bit)
+    if (sample) { // if high now, make sure it hasn't been high for too long
+      if (++d->stateCounter > NECIR_WINDOW(d, onePauseMax, NECIR_MAX(NECIR_NEC_ONE_PAUSE))) {
+        NECIR_STATS_COUNT(d, bitSpaceErrors);
+        d->state = NECIR_STATE_IDLE; // high for too long, switch to idle state
+      }
+    } else { // if low now, make sure that it was high for long enough
+      NECIR_STATS_MEASURED(d, bitSpaceHistogram);
+      if (d->stateCounter < NECIR_WINDOW(d, bitMin, NECIR_MIN(NECIR_NEC_BIT))) {
+        NECIR_STATS_COUNT(d, bitSpaceErrors);
+        d->state = NECIR_STATE_WAITING_FOR_IDLE; // was not high for long enough, switch to wait for idle state
+        break;
+      } else if (d->stateCounter > NECIR_WINDOW(d, bitMax, NECIR_MAX(NECIR_NEC_BIT))) // was high for longer than a 0-bit, so it's a 1-bit
+        d->message[d->bitCounter / 8] |= d->messageBit; // way faster than "uint32_t message |= ((uint32_t)1 << bitCounter)"
+      if (++d->bitCounter < NECIR_NEC_BITS) { // are there more bits we need to read in?
+#ifdef NECIR_ADDRESS_FILTER
+        if (d->bitCounter == NECIR_ADDRESS_BITS && !NECIR_DecoderAddressAllowed(d)) { // the address is complete, is the frame for us?
+          NECIR_DecoderRejectAddress(d);
+          break;
+        }
+#endif // NECIR_ADDRESS_FILTER
+        d->stateCounter = 0;
+        d->state = NECIR_STATE_BIT_LEADER; // attempt to read in another bit
+      } else
+        d->state = NECIR_STATE_PROCESS; // keep the maximum execution time of the ISR down by passing the message on in a new state
+    }
+    break;
+#endif // NECIR_PROTOCOL_NEC || NECIR_PROTOCOL_SAMSUNG32
+#if (NECIR_PROTOCOL_SIRC)
+  case NECIR_STATE_SIRC_SPACE: // IR was high, needs to be high for 600us, or for longer at the end of the frame
+    if (sample) { // if high now, check whether the frame is over
+      if (++d->stateCounter > NECIR_MAX(NECIR_SIRC_BIT)) {
+        if (d->bitCounter == 12 || d->bitCounter == 15 || d->bitCounter == 20)
+          d->state = NECIR_STATE_PROCESS;
+        else {
+          NECIR_STATS_COUNT(d, bitSpaceErrors);
+          d->state = NECIR_STATE_IDLE; // not a valid number of bits, switch to idle state
+        }
+      }
+    } else { // if low now, make sure that it was high for long enough
+      NECIR_STATS_MEASURED(d, bitSpaceHistogram);
+      if (d->stateCounter < NECIR_MIN(NECIR_SIRC_BIT)) {
+        NECIR_STATS_COUNT(d, bitSpaceErrors);
+        d->state = NECIR_STATE_WAITING_FOR_IDLE; // was not high for long enough, switch to wait for idle state
+      } else { // was high for 600us, switch to bit mark state
+        d->stateCounter = 0;
+        d->messageBit = NECIR_CORE_BIT_MASK(d->bitCounter % 8);
+        d->state = NECIR_STATE_SIRC_MARK;
+      }
+    }
+    break;
+  case NECIR_STATE_SIRC_MARK: // IR was low, needs to be low for either 600us (0-bit) or 1.2ms (1-bit)
+    if (!sample) { // if low now, make sure it hasn't been low for too long
+      if (++d->stateCounter > NECIR_MAX(NECIR_SIRC_ONE)) {
+        NECIR_STATS_COUNT(d, bitBurstErrors);
+        d->state = NECIR_STATE_LEADER; // low for too long, but this could be the leader of another frame
+      }
+    } else { // if high now, make sure that it was low for long enough
+      NECIR_STATS_MEASURED(d, bitBurstHistogram);
+      if (d->stateCounter < NECIR_MIN(NECIR_SIRC_BIT) || d->bitCounter == NECIR_SIRC_MAX_BITS) {
+        NECIR_STATS_COUNT(d, bitBurstErrors);
+        d->state = NECIR_STATE_IDLE; // was not low for long enough, or too many bits, switch to idle state
+        break;
+      } else if (d->stateCounter > NECIR_SPLIT(NECIR_SIRC_BIT, NECIR_SIRC_ONE)) // was low for longer than a 0-bit, so it's a 1-bit
+        d->message[d->bitCounter / 8] |= d->messageBit;
+      ++d->bitCounter;
+      d->stateCounter = 0;
+      d->state = NECIR_STATE_SIRC_SPACE;
+    }
+    break;
+#endif // NECIR_PROTOCOL_SIRC
+#if (NECIR_PROTOCOL_RC5)
+  case NECIR_STATE_MANCHESTER: // messageBit holds the level of the current run of half-bits, bitCounter the half-bit it began on
+    if (!sample == !d->messageBit) { // same level, make sure it hasn't lasted for more than two half-bits
+      if (++d->stateCounter > NECIR_MAX(NECIR_RC5_BIT)) {
+        if (!sample) {
+          NECIR_STATS_COUNT(d, bitBurstErrors);
+          d->state = NECIR_STATE_LEADER; // low for too long, but this could be the leader of another frame
+          break;
+        }
+        if (d->bitCounter & 1) { // the signal went idle in the second half of the last bit, so it was a 0-bit
+          NECIR_DecoderShiftBit(d, 0);
+          ++d->bitCounter;
+        }
+        if (d->bitCounter == 2 * NECIR_RC5_BITS)
+          d->state = NECIR_STATE_PROCESS;
+        else {
+          NECIR_STATS_COUNT(d, bitSpaceErrors);
+          d->state = NECIR_STATE_IDLE; // not enough bits, switch to idle state
+        }
+      }
+    } else { // the level changed, so the run of one or two half-bits is over
+#if (NECIR_STATS == 2)
+      if (d->messageBit)
+        NECIR_STATS_MEASURED(d, bitSpaceHistogram);
+      else
+        NECIR_STATS_MEASURED(d, bitBurstHistogram);
+#endif // NECIR_STATS
+      if (d->stateCounter < NECIR_MIN(NECIR_RC5_HALF_BIT)) {
+        NECIR_DecoderManchesterError(d);
+        d->state = NECIR_STATE_WAITING_FOR_IDLE; // was too short, switch to wait for idle state
+        break;
+      }
+      uint8_t halfBits = d->stateCounter > NECIR_SPLIT(NECIR_RC5_HALF_BIT, NECIR_RC5_BIT) ? 2 : 1;
+      if (d->bitCounter & 1) // the run began in the second half of a bit, which holds the bit: a burst is a 1
+        NECIR_DecoderShiftBit(d, !d->messageBit);
+      else if (halfBits == 2) { // both halves of a bit at the same level is not Manchester code
+        NECIR_DecoderManchesterError(d);
+        d->state = NECIR_STATE_WAITING_FOR_IDLE;
+        break;
+      }
+      if ((d->bitCounter += halfBits) > 2 * NECIR_RC5_BITS) { // too many bits
+        NECIR_DecoderManchesterError(d);
+        d->state = NECIR_STATE_WAITING_FOR_IDLE;
+        break;
+      }
+      d->messageBit = sample;
+      d->stateCounter = 0;
+    }
+    break;
+#endif // NECIR_PROTOCOL_RC5
+  case NECIR_STATE_PROCESS: // At this point 'message' contains the raw bits received
+#if (NECIR_FRAME_REPEATS)
+    if (NECIR_DecoderProtocol(d) != NECIR_NEC) {
+      uint8_t event = NECIR_DecoderFrameReceived(d, NECIR_SAMPLED_REPEAT_TIMEOUT);
+      if (event == NECIR_EVENT_MESSAGE)
+        d->state = NECIR_STATE_PROCESS2;
+      else if (event == NECIR_EVENT_REPEAT)
+        d->state = NECIR_STATE_REPEAT_PROCESS2;
+      else
+        d->state = NECIR_STATE_WAITING_FOR_IDLE;
+      return event;
+    }
+    NECIR_DecoderRememberMessage(d);
+#endif // NECIR_FRAME_REPEATS
+    NECIR_DecoderBeginRepeats(d);
+    d->state = NECIR_STATE_PROCESS2; // split the enqueue across two states to decrease the maximum running time of the ISR
+    return NECIR_EVENT_MESSAGE;
+  case NECIR_STATE_PROCESS2:
+    d->state = NECIR_STATE_WAITING_FOR_IDLE;
+    return NECIR_EVENT_MESSAGE_COMMIT;
+  }
+  return NECIR_EVENT_NONE;
+}
+
+// Fast-forwards the decoder through up to 'count' identical samples, but only
+// while they cannot change its state or produce an event. Returns how many
+// samples were consumed; the next sample must then go through
+// NECIR_DecoderStep(). This makes decoding a recorded trace cost a handful of
+// steps per pulse, rather than one step per sample.
+static inline uint32_t NECIR_DecoderSkip(necir_decoder_t *d, uint8_t sample, uint32_t count) __attribute__(( always_inline ));
+static inline uint32_t NECIR_DecoderSkip(necir_decoder_t *d, uint8_t sample, uint32_t count) {
+  uint8_t limit; // the largest stateCounter that the next sample does not reject
+
+  switch (d->state) {
+  case NECIR_STATE_WAITING_FOR_IDLE:
+    return sample ? 0 : count;
+  case NECIR_STATE_IDLE:
+    if (!sample)
+      return 0;
+    if (NECIR_CORE_GET_REPEAT_TIMEOUT_FLAG(d)) // still returns NECIR_EVENT_IDLE, which callers of this function don't need
+      return count;
+    // Leave the sample that makes the repeat timeout expire to NECIR_DecoderStep()
+    if (count > (uint16_t)(d->repeatTimeout - 1))
+      count = (uint16_t)(d->repeatTimeout - 1);
+    d->repeatTimeout -= count;
+    return count;
+  case NECIR_STATE_LEADER:
+    if (sample)
+      return 0;
+    limit = NECIR_WINDOW(d, leaderMax, NECIR_LEADER_MAX);
+    break;
+  case NECIR_STATE_PAUSE:
+    if (!sample)
+      return 0;
+    limit = NECIR_WINDOW(d, pauseMax, NECIR_MAX(NECIR_NEC_PAUSE));
+    break;
+  case NECIR_STATE_BIT_LEADER:
+    if (sample)
+      return 0;
+    limit = NECIR_WINDOW(d, bitMax, NECIR_MAX(NECIR_NEC_BIT));
+    break;
+  case NECIR_STATE_BIT_PAUSE:
+    if (!sample)
+      return 0;
+    limit = NECIR_WINDOW(d, onePauseMax, NECIR_MAX(NECIR_NEC_ONE_PAUSE));
+    break;
+  case NECIR_STATE_SIRC_SPACE:
+    if (!sample)
+      return 0;
+    limit = NECIR_MAX(NECIR_SIRC_BIT);
+    break;
+  case NECIR_STATE_SIRC_MARK:
+    if (sample)
+      return 0;
+    limit = NECIR_MAX(NECIR_SIRC_ONE);
+    break;
+  case NECIR_STATE_MANCHESTER:
+    if (!sample != !d->messageBit)
+      return 0;
+    limit = NECIR_MAX(NECIR_RC5_BIT);
+    break;
+  default: // the PROCESS states produce an event on every sample
+    return 0;
+  }
+
+  if (d->stateCounter >= limit)
+    return 0;
+  if (count > (uint8_t)(limit - d->stateCounter))
+    count = (uint8_t)(limit - d->stateCounter);
+  d->stateCounter += count;
+  return count;
+}
+#pragma GCC diagnostic pop
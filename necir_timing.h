@@ -0,0 +1,76 @@
+/*
+
+  necir_timing.h
+
+  Copyright 2014 Matthew T. Pandina. All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions
+  are met:
+
+  1. Redistributions of source code must retain the above copyright
+  notice, this list of conditions and the following disclaimer.
+
+  2. Redistributions in binary form must reproduce the above copyright
+  notice, this list of conditions and the following disclaimer in the
+  documentation and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY MATTHEW T. PANDINA "AS IS" AND ANY
+  EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+  PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL MATTHEW T. PANDINA OR
+  CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+  SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+  LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF
+  USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+  ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT
+  OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+  SUCH DAMAGE.
+
+*/
+
+// Sampling timer settings, worked out at compile time from F_CPU and
+// NECIR_SAMPLES_PER_BIT. This file only uses the preprocessor, so
+// necir_isr.S includes it as well as necir_core.h.
+//
+// The decoder takes NECIR_SAMPLES_PER_BIT samples per NEC bit (562.5us), so
+// the interrupt rate is about 1778 * NECIR_SAMPLES_PER_BIT per second on
+// every clock. The timer uses the smallest prescaler, of those that timers 0
+// and 2 have in common, that fits the sample period into its 8-bit OCR
+// register, and NECIR_CTC_TOP is rounded to the nearest count. That keeps the
+// period within half a timer count of nominal: with NECIR_CTC_TOP at least 31,
+// which is checked below, the period is off by 1.6% at most, and every
+// threshold is computed from the actual period anyway.
+
+#pragma once
+
+#if (NECIR_SAMPLES_PER_BIT < 2 || NECIR_SAMPLES_PER_BIT > 15)
+#error "NECIR_SAMPLES_PER_BIT must be between 2 and 15"
+#endif // NECIR_SAMPLES_PER_BIT
+
+// 562.5us is 9/16000 s
+#define NECIR_CTC_TOP_FOR_PRESCALE(p) ((F_CPU * 9 / NECIR_SAMPLES_PER_BIT / (p) + 8000) / 16000 - 1)
+
+#if (NECIR_CTC_TOP_FOR_PRESCALE(1) <= 255)
+#define NECIR_CTC_PRESCALE 1
+#elif (NECIR_CTC_TOP_FOR_PRESCALE(8) <= 255)
+#define NECIR_CTC_PRESCALE 8
+#elif (NECIR_CTC_TOP_FOR_PRESCALE(64) <= 255)
+#define NECIR_CTC_PRESCALE 64
+#elif (NECIR_CTC_TOP_FOR_PRESCALE(256) <= 255)
+#define NECIR_CTC_PRESCALE 256
+#elif (NECIR_CTC_TOP_FOR_PRESCALE(1024) <= 255)
+#define NECIR_CTC_PRESCALE 1024
+#else // NECIR_CTC_TOP_FOR_PRESCALE
+#error "F_CPU is too high for NECIR_SAMPLES_PER_BIT"
+#endif // NECIR_CTC_TOP_FOR_PRESCALE
+
+#define NECIR_CTC_TOP NECIR_CTC_TOP_FOR_PRESCALE(NECIR_CTC_PRESCALE)
+
+#if (NECIR_CTC_TOP < 31)
+#error "F_CPU is too low for NECIR_SAMPLES_PER_BIT, the sample period would be off by more than 1.6%"
+#endif // NECIR_CTC_TOP
+
+// Clock cycles per sample
+#define NECIR_SAMPLE_CYCLES ((NECIR_CTC_TOP + 1) * NECIR_CTC_PRESCALE)